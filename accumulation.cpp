@@ -0,0 +1,173 @@
+#include "accumulation.h"
+
+#include <algorithm>
+#include <iostream>
+
+void AccumulationBuffer::init(int targetWidth, int targetHeight, int samples, bool temporalReprojection, bool adaptive)
+{
+    width = renderWidth = targetWidth;
+    height = renderHeight = targetHeight;
+    maxSamples = samples;
+    temporal = temporalReprojection;
+    sampleCount = historySamples = 0;
+    average = 0;
+    moved = false;
+    hasView = false;
+
+    glCreateTextures(GL_TEXTURE_2D, 2, textures);
+    glCreateTextures(GL_TEXTURE_2D, 2, depthTextures);
+    if (adaptive)
+    {
+        glCreateTextures(GL_TEXTURE_2D, 2, momentTextures);
+    }
+    glCreateFramebuffers(2, framebuffers);
+    const GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    for (int i = 0; i < 2; i++)
+    {
+        glTextureStorage2D(textures[i], 1, GL_RGBA32F, width, height);
+        glTextureStorage2D(depthTextures[i], 1, GL_R32F, width, height);
+        if (adaptive)
+        {
+            glTextureStorage2D(momentTextures[i], 1, GL_R32F, width, height);
+        }
+        for (GLuint texture : { textures[i], depthTextures[i], momentTextures[i] })
+        {
+            if (texture)
+            {
+                glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            }
+        }
+        glNamedFramebufferTexture(framebuffers[i], GL_COLOR_ATTACHMENT0, textures[i], 0);
+        glNamedFramebufferTexture(framebuffers[i], GL_COLOR_ATTACHMENT1, depthTextures[i], 0);
+        if (adaptive)
+        {
+            glNamedFramebufferTexture(framebuffers[i], GL_COLOR_ATTACHMENT2, momentTextures[i], 0);
+        }
+        glNamedFramebufferDrawBuffers(framebuffers[i], adaptive ? 3 : 2, drawBuffers);
+        if (glCheckNamedFramebufferStatus(framebuffers[i], GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "Accumulation framebuffer is incomplete\n";
+        }
+    }
+}
+
+void AccumulationBuffer::release()
+{
+    if (framebuffers[0])
+    {
+        glDeleteFramebuffers(2, framebuffers);
+        glDeleteTextures(2, textures);
+        glDeleteTextures(2, depthTextures);
+        glDeleteTextures(2, momentTextures);
+        framebuffers[0] = framebuffers[1] = 0;
+        textures[0] = textures[1] = 0;
+        depthTextures[0] = depthTextures[1] = 0;
+        momentTextures[0] = momentTextures[1] = 0;
+    }
+}
+
+void AccumulationBuffer::set_view(const Vec3& cameraPos, float mouseX, float mouseY)
+{
+    bool changed = cameraPos.x != viewCameraPos.x || cameraPos.y != viewCameraPos.y || cameraPos.z != viewCameraPos.z
+                 || mouseX != viewMouseX || mouseY != viewMouseY;
+    if (!hasView)
+    {
+        reset();
+    }
+    else if (changed)
+    {
+        // The history stays for reprojection, but the new view has to converge anew
+        if (temporal)
+        {
+            sampleCount = 0;
+            moved = true;
+        }
+        else
+        {
+            reset();
+        }
+    }
+    hasView = true;
+    viewCameraPos = cameraPos;
+    viewMouseX = mouseX;
+    viewMouseY = mouseY;
+}
+
+void AccumulationBuffer::set_render_size(int targetWidth, int targetHeight)
+{
+    targetWidth = std::clamp(targetWidth, 1, width);
+    targetHeight = std::clamp(targetHeight, 1, height);
+    if (targetWidth != renderWidth || targetHeight != renderHeight)
+    {
+        renderWidth = targetWidth;
+        renderHeight = targetHeight;
+        reset();
+    }
+}
+
+static float radical_inverse(int index, int base)
+{
+    float result = 0.0f;
+    float scale = 1.0f / base;
+    for (; index > 0; index /= base, scale /= base)
+    {
+        result += (index % base) * scale;
+    }
+    return result;
+}
+
+AccumulationHistory AccumulationBuffer::history() const
+{
+    if (historySamples == 0)
+    {
+        return AccumulationHistoryNone;
+    }
+    return moved ? AccumulationHistoryReproject : AccumulationHistorySamePixel;
+}
+
+void AccumulationBuffer::next_jitter(float& x, float& y) const
+{
+    if (historySamples == 0)
+    {
+        x = y = 0.0f;
+        return;
+    }
+    x = radical_inverse(historySamples, 2) - 0.5f;
+    y = radical_inverse(historySamples, 3) - 0.5f;
+}
+
+void AccumulationBuffer::bind_for_sample()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1 - average]);
+    glViewport(0, 0, renderWidth, renderHeight);
+    glBindTextureUnit(0, textures[average]);
+    glBindTextureUnit(1, depthTextures[average]);
+    glBindTextureUnit(2, momentTextures[average]);
+}
+
+void AccumulationBuffer::bind_image_for_sample()
+{
+    glBindTextureUnit(0, textures[average]);
+    glBindTextureUnit(1, depthTextures[average]);
+    glBindTextureUnit(2, momentTextures[average]);
+    glBindImageTexture(0, textures[1 - average], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, depthTextures[1 - average], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glBindImageTexture(2, momentTextures[1 - average], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+}
+
+void AccumulationBuffer::finish_sample(const Camera& camera)
+{
+    average = 1 - average;
+    sampleCount++;
+    historySamples++;
+    moved = false;
+    historyCamera = camera;
+}
+
+void AccumulationBuffer::present() const
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[average]);
+    bool scaled = renderWidth != width || renderHeight != height;
+    glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "vec3.h"
+#include "camera.h"
+
+// How a sample uses the previous target, as HISTORY_* in temporal.glsl
+enum AccumulationHistory
+{
+    AccumulationHistoryNone,
+    AccumulationHistorySamePixel,
+    AccumulationHistoryReproject
+};
+
+// Progressive accumulation: two RGBA32F targets used ping-pong, each with an
+// R32F target beside it for the hit distance of every pixel's last camera
+// ray and, with adaptive sampling, another for its luminance moment
+// (adaptive.h). Each sample reads the running average, with the number of samples in
+// it in alpha, from one and the shader writes the updated average into the
+// other, with the ray jittered inside the pixel so the average converges to
+// an antialiased image. Once maxSamples are averaged the view is converged
+// and frames only present it. Changing the scene starts over. Moving the
+// camera does too unless temporal is set: then the shaders reproject the
+// history into the new view (temporal.glsl) and the view only counts as
+// converged again after maxSamples more. The fragment backend draws into
+// the targets; compute shaders write them as images. Under dynamic
+// resolution only the bottom-left render size of the targets is traced, and
+// present scales it up to the full size.
+// init and release need a current GL context.
+class AccumulationBuffer
+{
+public:
+    void init(int width, int height, int maxSamples, bool temporal, bool adaptive);
+    void release();
+
+    // Starts over, or reprojects when temporal, when the camera differs from
+    // the previous frame's.
+    void set_view(const Vec3& cameraPos, float mouseX, float mouseY);
+    // Starts over and drops the history, e.g. after the scene changed.
+    void reset() { sampleCount = historySamples = 0; }
+    // Traces width x height from the next sample on, at most the full size;
+    // starts over when it changes.
+    void set_render_size(int width, int height);
+    int render_width() const { return renderWidth; }
+    int render_height() const { return renderHeight; }
+
+    bool converged() const { return sampleCount >= maxSamples; }
+    // Samples since the view last changed
+    int sample_count() const { return sampleCount; }
+    // Samples since the history was last dropped, camera moves included;
+    // numbers the jitter and the shaders' random sequences
+    int history_samples() const { return historySamples; }
+    AccumulationHistory history() const;
+    // The camera of the last sample, which traced the history
+    const Camera& history_camera() const { return historyCamera; }
+    // Sub-pixel offset of the next sample in [-0.5, 0.5), from the Halton
+    // (2, 3) sequence. The first sample is the pixel center, so a single
+    // frame matches an unaccumulated one.
+    void next_jitter(float& x, float& y) const;
+
+    // Draw target for the next sample, average, hit distance and moment; the
+    // previous ones are bound to texture units 0, 1 and 2 for the shader to read.
+    void bind_for_sample();
+    // Compute alternative: the next targets are bound to image units 0, 1 and 2.
+    void bind_image_for_sample();
+    // Call after the sample's draw or dispatch, with the camera it used.
+    void finish_sample(const Camera& camera);
+    // Copies the current average into the bound draw framebuffer, scaled
+    // from the render size to the full size.
+    void present() const;
+
+private:
+    GLuint framebuffers[2] = {};
+    GLuint textures[2] = {};
+    GLuint depthTextures[2] = {};
+    GLuint momentTextures[2] = {};  // only with adaptive sampling
+    int width = 0;
+    int height = 0;
+    int renderWidth = 0;
+    int renderHeight = 0;
+    int maxSamples = 1;
+    int average = 0;        // which target holds the current average
+    int sampleCount = 0;
+    int historySamples = 0;
+    bool temporal = false;
+    bool moved = false;     // the view changed since the last sample
+    Camera historyCamera;
+    bool hasView = false;
+    Vec3 viewCameraPos;
+    float viewMouseX = 0.0f;
+    float viewMouseY = 0.0f;
+};
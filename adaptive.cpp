@@ -0,0 +1,81 @@
+#include "adaptive.h"
+
+#include <algorithm>
+#include <cmath>
+
+float pixel_error(float meanLuminance, float moment, float samples)
+{
+    if (samples < 2.0f)
+    {
+        return 1e30f;
+    }
+    float variance = std::max(moment, 0.0f) / (samples - 1.0f);
+    return std::sqrt(variance / samples) / std::max(meanLuminance, adaptiveLuminanceFloor);
+}
+
+uint32_t next_tile_state(uint32_t state, float tileError, float errorThreshold)
+{
+    uint32_t samples = state & ~tileActive;
+    bool sampling = state == 0 || ((state & tileActive) && (samples < adaptiveMinSamples || tileError > errorThreshold));
+    return sampling ? tileActive | (samples + 1) : samples;
+}
+
+AdaptiveStats adaptive_stats(const std::vector<uint32_t>& tiles, int width, int height)
+{
+    AdaptiveStats stats = {};
+    int tilesX = (width + adaptiveTileSize - 1) / adaptiveTileSize;
+    int tilesY = (height + adaptiveTileSize - 1) / adaptiveTileSize;
+    long long mostSamples = 0;
+    for (int ty = 0; ty < tilesY; ty++)
+    {
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            uint32_t state = tiles[ty * tilesX + tx];
+            long long samples = state & ~tileActive;
+            long long pixels = static_cast<long long>(std::min(adaptiveTileSize, width - tx * adaptiveTileSize))
+                             * std::min(adaptiveTileSize, height - ty * adaptiveTileSize);
+            stats.tracedSamples += samples * pixels;
+            stats.activeTiles += (state & tileActive) != 0;
+            mostSamples = std::max(mostSamples, samples);
+        }
+    }
+    // Uniform sampling gives every tile as many samples as the one that needed the most
+    stats.uniformSamples = mostSamples * width * height;
+    stats.tileCount = tilesX * tilesY;
+    return stats;
+}
+
+void TileScheduler::reset(int imageWidth, int imageHeight)
+{
+    width = imageWidth;
+    height = imageHeight;
+    tilesX = (width + adaptiveTileSize - 1) / adaptiveTileSize;
+    tilesY = (height + adaptiveTileSize - 1) / adaptiveTileSize;
+    tiles.assign(static_cast<size_t>(tilesX) * tilesY, 0);
+}
+
+void TileScheduler::schedule(const std::vector<Vec3>& average, const std::vector<float>& moments, float errorThreshold, ThreadPool& pool)
+{
+    pool.parallel_for(tilesY, [&](int ty)
+    {
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            uint32_t& tile = tiles[ty * tilesX + tx];
+            // Only active tiles past the minimum look at their pixels
+            float tileError = 0.0f;
+            uint32_t samples = tile & ~tileActive;
+            if ((tile & tileActive) && samples >= adaptiveMinSamples)
+            {
+                for (int y = ty * adaptiveTileSize; y < std::min((ty + 1) * adaptiveTileSize, height); y++)
+                {
+                    for (int x = tx * adaptiveTileSize; x < std::min((tx + 1) * adaptiveTileSize, width); x++)
+                    {
+                        size_t i = static_cast<size_t>(y) * width + x;
+                        tileError = std::max(tileError, pixel_error(luminance(average[i]), moments[i], float(samples)));
+                    }
+                }
+            }
+            tile = next_tile_state(tile, tileError, errorThreshold);
+        }
+    });
+}
@@ -0,0 +1,53 @@
+// Adaptive sampling shared by the tracing shaders and adaptive_schedule.comp,
+// as described in adaptive.h: a state per 8x8 tile says whether the tile
+// takes this sample, and pixels of tiles that stopped carry their history
+// over. Needs raytrace.glsl.
+
+// Defined true by the C++ side when it schedules tiles; otherwise every
+// pixel takes every sample and the tile states are never read
+#ifndef ADAPTIVE_SAMPLING
+#define ADAPTIVE_SAMPLING false
+#endif
+
+const int ADAPTIVE_TILE_SIZE = 8;
+const uint ADAPTIVE_MIN_SAMPLES = 8u;
+const float ADAPTIVE_LUMINANCE_FLOOR = 0.1;
+const uint TILE_ACTIVE = 0x80000000u;
+
+// Per tile of the traced size, row by row: the samples it took since the
+// view changed, with TILE_ACTIVE set while it still takes them; 0 for a tile
+// of a new view
+layout(std430, binding = 8) buffer AdaptiveTileBuffer
+{
+    uint tileStates[];
+};
+
+uint tileIndex(ivec2 pixel)
+{
+    int tilesX = (windowWidth + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    return uint((pixel.y / ADAPTIVE_TILE_SIZE) * tilesX + pixel.x / ADAPTIVE_TILE_SIZE);
+}
+
+// Whether pixel traces this sample or keeps its history
+bool pixelSampled(ivec2 pixel)
+{
+    return !ADAPTIVE_SAMPLING || (tileStates[tileIndex(pixel)] & TILE_ACTIVE) != 0u;
+}
+
+// Relative standard error of a pixel's mean luminance from its sum of
+// squared deviations over samples samples, as pixel_error in adaptive.cpp
+float pixelError(float meanLuminance, float moment, float samples)
+{
+    if (samples < 2.0)
+        return 1e30;
+    float variance = max(moment, 0.0) / (samples - 1.0);
+    return sqrt(variance / samples) / max(meanLuminance, ADAPTIVE_LUMINANCE_FLOOR);
+}
+
+// A tile's state for the next sample, as next_tile_state in adaptive.cpp
+uint nextTileState(uint state, float tileError, float errorThreshold)
+{
+    uint samples = state & ~TILE_ACTIVE;
+    bool sampling = state == 0u || ((state & TILE_ACTIVE) != 0u && (samples < ADAPTIVE_MIN_SAMPLES || tileError > errorThreshold));
+    return sampling ? TILE_ACTIVE | (samples + 1u) : samples;
+}
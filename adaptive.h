@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "vec3.h"
+#include "thread_pool.h"
+
+// Adaptive sampling: next to its running average every pixel keeps the sum
+// of squared deviations of its samples' luminance from their mean, updated
+// as in Welford's algorithm, so the variance of the average is known. Before
+// each sample a scheduler decides per adaptiveTileSize tile whether it takes
+// one: a tile stops once the largest relative standard error among its
+// pixels is at most the error threshold, after at least adaptiveMinSamples,
+// and stays stopped until the view changes, its pixels carrying their
+// average over unchanged. The GPU version is adaptive.glsl and
+// adaptive_schedule.comp; TileScheduler is the CPU path tracer's.
+
+const int adaptiveTileSize = 8;     // the compute backends' 8x8 tiles
+const int adaptiveMinSamples = 8;   // before which no tile trusts its variance
+// Mean luminance below which errors are taken relative to this instead, so
+// dark pixels don't chase a relative error their noise never reaches
+const float adaptiveLuminanceFloor = 0.1f;
+
+// Tile state, as in adaptive.glsl: the samples the tile took since the view
+// changed, with tileActive set while it still takes them. 0 is a tile of a
+// new view, which always takes the next sample.
+const uint32_t tileActive = 0x80000000u;
+
+inline float luminance(const Vec3& color)
+{
+    return dot(color, Vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Relative standard error of a pixel's mean luminance from its sum of
+// squared deviations over samples samples
+float pixel_error(float meanLuminance, float moment, float samples);
+
+// A tile's state for the next sample, given its state and the largest error
+// among its pixels
+uint32_t next_tile_state(uint32_t state, float tileError, float errorThreshold);
+
+struct AdaptiveStats
+{
+    long long tracedSamples;    // pixel samples traced since the view changed
+    long long uniformSamples;   // what uniform sampling traces for every tile to reach the same error bound
+    int activeTiles;
+    int tileCount;
+};
+
+// Stats of the tile states of a width x height image, tiles row by row
+AdaptiveStats adaptive_stats(const std::vector<uint32_t>& tiles, int width, int height);
+
+// The CPU scheduler, over per-pixel averages and moments like the path
+// tracer's
+class TileScheduler
+{
+public:
+    // Every tile of a width x height image takes the next sample.
+    void reset(int width, int height);
+    // Picks the tiles that take the next sample.
+    void schedule(const std::vector<Vec3>& average, const std::vector<float>& moments, float errorThreshold, ThreadPool& pool);
+
+    bool sampled(int x, int y) const { return (state(x, y) & tileActive) != 0; }
+    // Samples pixel (x, y) has taken, the scheduled one included
+    int samples(int x, int y) const { return static_cast<int>(state(x, y) & ~tileActive); }
+    AdaptiveStats stats() const { return adaptive_stats(tiles, width, height); }
+
+private:
+    uint32_t state(int x, int y) const { return tiles[(y / adaptiveTileSize) * tilesX + x / adaptiveTileSize]; }
+
+    std::vector<uint32_t> tiles;
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+};
@@ -0,0 +1,41 @@
+#include "adaptive_buffer.h"
+
+static int tile_count(int width, int height)
+{
+    return ((width + adaptiveTileSize - 1) / adaptiveTileSize) * ((height + adaptiveTileSize - 1) / adaptiveTileSize);
+}
+
+void AdaptiveTileBuffer::init(int width, int height)
+{
+    tileCount = tile_count(width, height);
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, tileCount * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    reset();
+}
+
+void AdaptiveTileBuffer::release()
+{
+    if (buffer)
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+}
+
+void AdaptiveTileBuffer::bind() const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, buffer);
+}
+
+void AdaptiveTileBuffer::reset()
+{
+    const GLuint fresh = 0;
+    glClearNamedBufferData(buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &fresh);
+}
+
+AdaptiveStats AdaptiveTileBuffer::read_stats(int width, int height) const
+{
+    std::vector<uint32_t> tiles(tile_count(width, height));
+    glGetNamedBufferSubData(buffer, 0, tiles.size() * sizeof(GLuint), tiles.data());
+    return adaptive_stats(tiles, width, height);
+}
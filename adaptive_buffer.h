@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "adaptive.h"
+
+// GPU tile states of adaptive sampling, one uint per tile of the traced size
+// as in adaptive.glsl, bound to shader storage binding 8. Sized for the
+// whole window, since the traced size only ever shrinks from it;
+// adaptive_schedule.comp updates the states and the tracing shaders read
+// them, so the CPU only clears them and reads them back for stats.
+// init and release need a current GL context.
+class AdaptiveTileBuffer
+{
+public:
+    void init(int width, int height);
+    void release();
+
+    void bind() const;
+    // Every tile takes the next sample, for a view that starts over.
+    void reset();
+    // Reads the states of a traced width x height back, which waits for the GPU.
+    AdaptiveStats read_stats(int width, int height) const;
+
+private:
+    GLuint buffer = 0;
+    int tileCount = 0;
+};
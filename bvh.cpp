@@ -0,0 +1,587 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+// SAH costs relative to one primitive test
+const float traversalCost = 1.0f;
+const float intersectCost = 1.0f;
+// Leaves larger than this are split even when the SAH says not to
+const uint32_t maxLeafSize = 16;
+
+struct BuildPrim
+{
+    Aabb bounds;
+    Vec3 centroid;
+    uint32_t id;
+};
+
+uint32_t primitive_count(const Scene& scene)
+{
+    return static_cast<uint32_t>(scene.spheres.size() + scene.triangles.size() + scene.instances.size());
+}
+
+Aabb primitive_bounds(const Scene& scene, uint32_t prim)
+{
+    Aabb bounds;
+    size_t instanceBase = scene.spheres.size() + scene.triangles.size();
+    if (prim >= instanceBase)
+    {
+        const Instance& instance = scene.instances[prim - instanceBase];
+        const Mesh& mesh = scene.meshes[instance.mesh];
+        for (int corner = 0; corner < 8; corner++)
+        {
+            Vec3 p((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x,
+                   (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y,
+                   (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+            bounds.grow(instance.objectToWorld.point(p));
+        }
+    }
+    else if (prim < scene.spheres.size())
+    {
+        const Sphere& sphere = scene.spheres[prim];
+        Vec3 r(sphere.radius, sphere.radius, sphere.radius);
+        bounds.grow(sphere.center - r);
+        bounds.grow(sphere.center + r);
+    }
+    else
+    {
+        const Triangle& triangle = scene.triangles[prim - scene.spheres.size()];
+        bounds.grow(triangle.v0);
+        bounds.grow(triangle.v1);
+        bounds.grow(triangle.v2);
+    }
+    return bounds;
+}
+
+static void sort_by_axis(std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, int axis)
+{
+    std::sort(prims.begin() + first, prims.begin() + first + count,
+        [axis](const BuildPrim& a, const BuildPrim& b) { return a.centroid[axis] < b.centroid[axis]; });
+}
+
+static void build_recursive(std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, int depth, Bvh& bvh)
+{
+    uint32_t nodeIndex = static_cast<uint32_t>(bvh.nodes.size());
+    bvh.nodes.emplace_back();
+
+    Aabb bounds;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        bounds.grow(prims[i].bounds);
+    }
+    bvh.nodes[nodeIndex].boundsMin = bounds.min;
+    bvh.nodes[nodeIndex].boundsMax = bounds.max;
+
+    // Sweep every axis; rightAreas[i] is the area of primitives [i, count)
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    float bestCost = 1e30f;
+    if (count > 1 && depth < bvhMaxDepth - 1)
+    {
+        std::vector<float> rightAreas(count);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sort_by_axis(prims, first, count, axis);
+
+            Aabb right;
+            for (uint32_t i = count - 1; i > 0; i--)
+            {
+                right.grow(prims[first + i].bounds);
+                rightAreas[i] = right.area();
+            }
+
+            Aabb left;
+            for (uint32_t i = 1; i < count; i++)
+            {
+                left.grow(prims[first + i - 1].bounds);
+                float cost = left.area() * i + rightAreas[i] * (count - i);
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+    }
+
+    float parentArea = bounds.area();
+    float splitCost = traversalCost + intersectCost * (parentArea > 0.0f ? bestCost / parentArea : float(count));
+    float leafCost = intersectCost * count;
+    if (bestAxis < 0 || (splitCost >= leafCost && count <= maxLeafSize))
+    {
+        bvh.nodes[nodeIndex].leftFirst = first;
+        bvh.nodes[nodeIndex].count = count;
+        return;
+    }
+
+    if (bestAxis != 2)
+    {
+        sort_by_axis(prims, first, count, bestAxis);
+    }
+    build_recursive(prims, first, bestSplit, depth + 1, bvh);
+    bvh.nodes[nodeIndex].leftFirst = static_cast<uint32_t>(bvh.nodes.size());
+    bvh.nodes[nodeIndex].count = 0;
+    build_recursive(prims, first + bestSplit, count - bestSplit, depth + 1, bvh);
+}
+
+static BuildPrim make_build_prim(const Scene& scene, uint32_t id)
+{
+    BuildPrim prim;
+    prim.bounds = primitive_bounds(scene, id);
+    prim.centroid = (prim.bounds.min + prim.bounds.max) * 0.5f;
+    prim.id = id;
+    return prim;
+}
+
+Bvh build_bvh_sah(const Scene& scene)
+{
+    uint32_t primCount = primitive_count(scene);
+    std::vector<BuildPrim> prims(primCount);
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        prims[i] = make_build_prim(scene, i);
+    }
+
+    Bvh bvh;
+    if (primCount == 0)
+    {
+        return bvh;
+    }
+    bvh.nodes.reserve(2 * primCount);
+    build_recursive(prims, 0, primCount, 0, bvh);
+
+    bvh.primIndices.resize(primCount);
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        bvh.primIndices[i] = prims[i].id;
+    }
+    return bvh;
+}
+
+struct Bin
+{
+    Aabb bounds;
+    uint32_t count = 0;
+};
+
+struct BinnedSplit
+{
+    int axis = -1;
+    int bin = 0;        // bins [0, bin] go left
+    float cost = 1e30f;
+};
+
+// Node and centroid bounds of a primitive range
+static void range_bounds(const std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, Aabb& bounds, Aabb& centroids)
+{
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        bounds.grow(prims[i].bounds);
+        centroids.grow(prims[i].centroid);
+    }
+}
+
+static int bin_index(const Vec3& centroid, const Aabb& centroids, const Vec3& scale, int axis)
+{
+    int bin = static_cast<int>((centroid[axis] - centroids.min[axis]) * scale[axis]);
+    return std::min(std::max(bin, 0), bvhBinCount - 1);
+}
+
+static Vec3 bin_scale(const Aabb& centroids)
+{
+    Vec3 extent = centroids.max - centroids.min;
+    Vec3 scale;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        scale[axis] = extent[axis] > 0.0f ? bvhBinCount / extent[axis] : 0.0f;
+    }
+    return scale;
+}
+
+static void fill_bins(const std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, const Aabb& centroids, Bin (&bins)[3][bvhBinCount])
+{
+    Vec3 scale = bin_scale(centroids);
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            Bin& bin = bins[axis][bin_index(prims[i].centroid, centroids, scale, axis)];
+            bin.bounds.grow(prims[i].bounds);
+            bin.count++;
+        }
+    }
+}
+
+// Below this many primitives binning a node on one thread beats splitting the work
+const uint32_t parallelBinningThreshold = 1 << 16;
+
+static BinnedSplit find_binned_split(const std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, const Aabb& centroids, ThreadPool* pool)
+{
+    Bin bins[3][bvhBinCount];
+    if (pool && pool->size() > 1 && count >= parallelBinningThreshold)
+    {
+        int chunks = static_cast<int>(pool->size()) * 4;
+        std::vector<Bin> chunkBins(static_cast<size_t>(chunks) * 3 * bvhBinCount);
+        uint32_t chunkSize = (count + chunks - 1) / chunks;
+        pool->parallel_for(chunks, [&](int chunk)
+        {
+            uint32_t begin = first + std::min(count, chunk * chunkSize);
+            uint32_t end = first + std::min(count, (chunk + 1) * chunkSize);
+            Bin local[3][bvhBinCount];
+            fill_bins(prims, begin, end - begin, centroids, local);
+            std::copy(&local[0][0], &local[0][0] + 3 * bvhBinCount, chunkBins.begin() + static_cast<size_t>(chunk) * 3 * bvhBinCount);
+        });
+        for (int chunk = 0; chunk < chunks; chunk++)
+        {
+            const Bin* local = &chunkBins[static_cast<size_t>(chunk) * 3 * bvhBinCount];
+            for (int b = 0; b < 3 * bvhBinCount; b++)
+            {
+                Bin& bin = bins[b / bvhBinCount][b % bvhBinCount];
+                bin.bounds.grow(local[b].bounds);
+                bin.count += local[b].count;
+            }
+        }
+    }
+    else
+    {
+        fill_bins(prims, first, count, centroids, bins);
+    }
+
+    BinnedSplit best;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (centroids.max[axis] <= centroids.min[axis])
+        {
+            continue;
+        }
+
+        float rightArea[bvhBinCount];
+        uint32_t rightCount[bvhBinCount];
+        Aabb right;
+        uint32_t rightSum = 0;
+        for (int b = bvhBinCount - 1; b > 0; b--)
+        {
+            right.grow(bins[axis][b].bounds);
+            rightSum += bins[axis][b].count;
+            rightArea[b] = right.area();
+            rightCount[b] = rightSum;
+        }
+
+        Aabb left;
+        uint32_t leftSum = 0;
+        for (int b = 0; b < bvhBinCount - 1; b++)
+        {
+            left.grow(bins[axis][b].bounds);
+            leftSum += bins[axis][b].count;
+            if (leftSum == 0 || rightCount[b + 1] == 0)
+            {
+                continue;
+            }
+            float cost = left.area() * leftSum + rightArea[b + 1] * rightCount[b + 1];
+            if (cost < best.cost)
+            {
+                best.axis = axis;
+                best.bin = b;
+                best.cost = cost;
+            }
+        }
+    }
+    return best;
+}
+
+// Splits a range in place. Returns the size of the left half, or 0 when the
+// range should stay a leaf.
+static uint32_t split_binned(std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, int depth,
+                             const Aabb& bounds, const Aabb& centroids, ThreadPool* pool)
+{
+    if (count <= 1 || depth >= bvhMaxDepth - 1)
+    {
+        return 0;
+    }
+
+    BinnedSplit split = find_binned_split(prims, first, count, centroids, pool);
+    if (split.axis < 0)
+    {
+        // Every centroid coincides; halve big ranges anyway so leaves stay bounded
+        return count > maxLeafSize ? count / 2 : 0;
+    }
+
+    float parentArea = bounds.area();
+    float splitCost = traversalCost + intersectCost * (parentArea > 0.0f ? split.cost / parentArea : float(count));
+    if (splitCost >= intersectCost * count && count <= maxLeafSize)
+    {
+        return 0;
+    }
+
+    Vec3 scale = bin_scale(centroids);
+    auto middle = std::partition(prims.begin() + first, prims.begin() + first + count,
+        [&](const BuildPrim& prim) { return bin_index(prim.centroid, centroids, scale, split.axis) <= split.bin; });
+    return static_cast<uint32_t>(middle - (prims.begin() + first));
+}
+
+static void build_binned_recursive(std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, int depth, std::vector<BvhNode>& nodes)
+{
+    uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    Aabb bounds, centroids;
+    range_bounds(prims, first, count, bounds, centroids);
+    nodes[nodeIndex].boundsMin = bounds.min;
+    nodes[nodeIndex].boundsMax = bounds.max;
+
+    uint32_t leftCount = split_binned(prims, first, count, depth, bounds, centroids, nullptr);
+    if (leftCount == 0)
+    {
+        nodes[nodeIndex].leftFirst = first;
+        nodes[nodeIndex].count = count;
+        return;
+    }
+
+    build_binned_recursive(prims, first, leftCount, depth + 1, nodes);
+    nodes[nodeIndex].leftFirst = static_cast<uint32_t>(nodes.size());
+    nodes[nodeIndex].count = 0;
+    build_binned_recursive(prims, first + leftCount, count - leftCount, depth + 1, nodes);
+}
+
+// Node of the serially split upper tree; either interior or a handle to a subtree job
+struct TopNode
+{
+    Aabb bounds;
+    int left = -1, right = -1;
+    int subtree = -1;
+};
+
+struct SubtreeJob
+{
+    uint32_t first, count;
+    int depth;
+    std::vector<BvhNode> nodes;
+};
+
+static int split_top(std::vector<BuildPrim>& prims, uint32_t first, uint32_t count, int depth, uint32_t jobThreshold,
+                     ThreadPool& pool, std::vector<TopNode>& top, std::vector<SubtreeJob>& jobs)
+{
+    int index = static_cast<int>(top.size());
+    top.emplace_back();
+    Aabb bounds, centroids;
+    range_bounds(prims, first, count, bounds, centroids);
+    top[index].bounds = bounds;
+
+    uint32_t leftCount = count > jobThreshold ? split_binned(prims, first, count, depth, bounds, centroids, &pool) : 0;
+    if (leftCount == 0)
+    {
+        top[index].subtree = static_cast<int>(jobs.size());
+        jobs.push_back({ first, count, depth, {} });
+        return index;
+    }
+
+    int left = split_top(prims, first, leftCount, depth + 1, jobThreshold, pool, top, jobs);
+    int right = split_top(prims, first + leftCount, count - leftCount, depth + 1, jobThreshold, pool, top, jobs);
+    top[index].left = left;
+    top[index].right = right;
+    return index;
+}
+
+// Emits the upper tree depth first, splicing in each job's nodes with indices rebased
+static void emit_top(const std::vector<TopNode>& top, int index, const std::vector<SubtreeJob>& jobs, std::vector<BvhNode>& nodes)
+{
+    const TopNode& node = top[index];
+    if (node.subtree >= 0)
+    {
+        uint32_t base = static_cast<uint32_t>(nodes.size());
+        for (BvhNode copy : jobs[node.subtree].nodes)
+        {
+            if (!copy.is_leaf())
+            {
+                copy.leftFirst += base;
+            }
+            nodes.push_back(copy);
+        }
+        return;
+    }
+
+    uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    nodes[nodeIndex].boundsMin = node.bounds.min;
+    nodes[nodeIndex].boundsMax = node.bounds.max;
+    nodes[nodeIndex].count = 0;
+    emit_top(top, node.left, jobs, nodes);
+    nodes[nodeIndex].leftFirst = static_cast<uint32_t>(nodes.size());
+    emit_top(top, node.right, jobs, nodes);
+}
+
+Bvh build_bvh_binned(const Scene& scene, ThreadPool& pool)
+{
+    uint32_t primCount = primitive_count(scene);
+    Bvh bvh;
+    if (primCount == 0)
+    {
+        return bvh;
+    }
+
+    std::vector<BuildPrim> prims(primCount);
+    const int setupChunk = 4096;
+    pool.parallel_for((primCount + setupChunk - 1) / setupChunk, [&](int chunk)
+    {
+        uint32_t end = std::min<uint32_t>(primCount, (chunk + 1) * setupChunk);
+        for (uint32_t i = chunk * setupChunk; i < end; i++)
+        {
+            prims[i] = make_build_prim(scene, i);
+        }
+    });
+
+    // Enough jobs per thread that uneven subtrees still balance
+    uint32_t jobThreshold = pool.size() > 1 ? std::max<uint32_t>(1024, primCount / (pool.size() * 8)) : primCount;
+    std::vector<TopNode> top;
+    std::vector<SubtreeJob> jobs;
+    split_top(prims, 0, primCount, 0, jobThreshold, pool, top, jobs);
+
+    pool.parallel_for(static_cast<int>(jobs.size()), [&](int j)
+    {
+        SubtreeJob& job = jobs[j];
+        job.nodes.reserve(2 * job.count);
+        build_binned_recursive(prims, job.first, job.count, job.depth, job.nodes);
+    });
+
+    bvh.nodes.reserve(2 * primCount);
+    emit_top(top, 0, jobs, bvh.nodes);
+
+    bvh.primIndices.resize(primCount);
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        bvh.primIndices[i] = prims[i].id;
+    }
+    return bvh;
+}
+
+bool parse_bvh_builder(const std::string& name, BvhBuilder& builder)
+{
+    for (BvhBuilder candidate : { BvhBuilderSweep, BvhBuilderBinned, BvhBuilderLbvh })
+    {
+        if (name == bvh_builder_name(candidate))
+        {
+            builder = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* bvh_builder_name(BvhBuilder builder)
+{
+    switch (builder)
+    {
+    case BvhBuilderSweep: return "sweep";
+    case BvhBuilderBinned: return "binned";
+    case BvhBuilderLbvh: return "lbvh";
+    }
+    return "unknown";
+}
+
+Bvh build_bvh(const Scene& scene, BvhBuilder builder, ThreadPool& pool)
+{
+    switch (builder)
+    {
+    case BvhBuilderSweep: return build_bvh_sah(scene);
+    case BvhBuilderLbvh: return build_bvh_lbvh(scene, pool);
+    case BvhBuilderBinned: break;
+    }
+    return build_bvh_binned(scene, pool);
+}
+
+std::vector<Bvh> build_mesh_bvhs(const Scene& scene, BvhBuilder builder, ThreadPool& pool)
+{
+    std::vector<Bvh> meshBvhs;
+    meshBvhs.reserve(scene.meshes.size());
+    for (const Mesh& mesh : scene.meshes)
+    {
+        // The builders work on scenes; a triangle-only one keeps ids equal to mesh triangle indices
+        Scene meshScene;
+        meshScene.triangles = mesh.triangles;
+        meshBvhs.push_back(build_bvh(meshScene, builder, pool));
+    }
+    return meshBvhs;
+}
+
+static float node_area(const BvhNode& node)
+{
+    Aabb bounds;
+    bounds.min = node.boundsMin;
+    bounds.max = node.boundsMax;
+    return bounds.area();
+}
+
+float bvh_sah_cost(const Bvh& bvh)
+{
+    if (bvh.nodes.empty())
+    {
+        return 0.0f;
+    }
+    float rootArea = std::max(node_area(bvh.nodes[0]), 1e-20f);
+    float cost = 0.0f;
+    for (const BvhNode& node : bvh.nodes)
+    {
+        float weight = node_area(node) / rootArea;
+        cost += weight * (node.is_leaf() ? intersectCost * node.count : traversalCost);
+    }
+    return cost;
+}
+
+// Changed nodes closer together than this are uploaded as one range
+const uint32_t refitMergeGap = 8;
+
+static bool same_bounds(const BvhNode& node, const Aabb& bounds)
+{
+    return node.boundsMin.x == bounds.min.x && node.boundsMin.y == bounds.min.y && node.boundsMin.z == bounds.min.z
+        && node.boundsMax.x == bounds.max.x && node.boundsMax.y == bounds.max.y && node.boundsMax.z == bounds.max.z;
+}
+
+std::vector<NodeRange> refit_bvh(Bvh& bvh, const Scene& scene)
+{
+    std::vector<NodeRange> changed;
+    // Children always come after their parent in depth-first order, so a
+    // reverse sweep has both child boxes ready when it reaches a node
+    for (size_t i = bvh.nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = bvh.nodes[i];
+        Aabb bounds;
+        if (node.is_leaf())
+        {
+            for (uint32_t p = node.leftFirst; p < node.leftFirst + node.count; p++)
+            {
+                bounds.grow(primitive_bounds(scene, bvh.primIndices[p]));
+            }
+        }
+        else
+        {
+            const BvhNode& left = bvh.nodes[i + 1];
+            const BvhNode& right = bvh.nodes[node.leftFirst];
+            bounds.grow(left.boundsMin);
+            bounds.grow(left.boundsMax);
+            bounds.grow(right.boundsMin);
+            bounds.grow(right.boundsMax);
+        }
+
+        if (same_bounds(node, bounds))
+        {
+            continue;
+        }
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+
+        // Ranges are collected back to front; extend the latest one when close enough
+        uint32_t index = static_cast<uint32_t>(i);
+        if (!changed.empty() && changed.back().first - index <= refitMergeGap)
+        {
+            changed.back().count += changed.back().first - index;
+            changed.back().first = index;
+        }
+        else
+        {
+            changed.push_back({ index, 1 });
+        }
+    }
+    std::reverse(changed.begin(), changed.end());
+    return changed;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "scene.h"
+#include "thread_pool.h"
+
+struct Aabb
+{
+    Vec3 min = Vec3(1e30f, 1e30f, 1e30f);
+    Vec3 max = Vec3(-1e30f, -1e30f, -1e30f);
+
+    void grow(const Vec3& p) { min = ::min(min, p); max = ::max(max, p); }
+    void grow(const Aabb& b) { min = ::min(min, b.min); max = ::max(max, b.max); }
+    bool empty() const { return min.x > max.x; }
+
+    float area() const
+    {
+        if (empty())
+            return 0.0f;
+        Vec3 e = max - min;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+// 32 bytes, uploaded as two vec4s. Nodes are stored depth first: the left
+// child of an interior node is always the next node, so leftFirst holds the
+// right child index for interior nodes and the first primitive for leaves.
+struct BvhNode
+{
+    Vec3 boundsMin;
+    uint32_t leftFirst;
+    Vec3 boundsMax;
+    uint32_t count;     // 0 for interior nodes
+
+    bool is_leaf() const { return count > 0; }
+};
+
+// Primitive ids span the scene arrays in order: spheres, then triangles
+// offset by the sphere count, then instances offset by both. A Bvh over a
+// scene with instances is the top level of a two-level structure; each
+// instance leaf continues into its mesh's bottom-level Bvh in object space.
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primIndices;
+};
+
+// Both the shader and the CPU traversal keep far children on a stack this deep,
+// so builders stop splitting below it.
+const int bvhMaxDepth = 32;
+
+uint32_t primitive_count(const Scene& scene);
+// Instances are bounded by their mesh's box carried into world space.
+Aabb primitive_bounds(const Scene& scene, uint32_t prim);
+
+// Full-sweep SAH: every centroid-ordered split on every axis is evaluated.
+// Best trees, but O(n log^2 n) and single threaded; kept as a quality reference.
+Bvh build_bvh_sah(const Scene& scene);
+
+// Binned SAH with bvhBinCount bins per axis. The top of the tree is split
+// serially (binning large nodes across the pool), then the remaining subtrees
+// are built as independent pool jobs and stitched back in depth-first order.
+const int bvhBinCount = 16;
+Bvh build_bvh_binned(const Scene& scene, ThreadPool& pool);
+
+// Linear BVH: primitives sorted by Morton code of their centroid (30-bit, or
+// 63-bit for over a million primitives) with a parallel radix sort, then a
+// Karras radix tree emitted depth first. Much faster to build than SAH, at
+// the cost of a worse tree; meant for scenes that change every frame.
+Bvh build_bvh_lbvh(const Scene& scene, ThreadPool& pool);
+
+enum BvhBuilder
+{
+    BvhBuilderSweep,
+    BvhBuilderBinned,
+    BvhBuilderLbvh
+};
+
+// Accepts "sweep", "binned" or "lbvh".
+bool parse_bvh_builder(const std::string& name, BvhBuilder& builder);
+const char* bvh_builder_name(BvhBuilder builder);
+Bvh build_bvh(const Scene& scene, BvhBuilder builder, ThreadPool& pool);
+
+// Bottom-level BVHs, one per scene mesh in mesh order, over each mesh's
+// object-space triangles (primitive ids index mesh.triangles). Built once;
+// moving instances only touches the top level.
+std::vector<Bvh> build_mesh_bvhs(const Scene& scene, BvhBuilder builder, ThreadPool& pool);
+
+// Expected traversal cost relative to a single leaf, for comparing trees.
+float bvh_sah_cost(const Bvh& bvh);
+
+struct NodeRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// Recomputes every node's bounds bottom-up from the scene's current primitive
+// positions, keeping the topology. Returns the ranges of nodes whose bounds
+// changed so only those need re-uploading. Refits let the tree degrade, so
+// callers compare bvh_sah_cost against the cost after the last full build.
+std::vector<NodeRange> refit_bvh(Bvh& bvh, const Scene& scene);
@@ -0,0 +1,32 @@
+#include "camera.h"
+
+const float PI = 3.1415926535897932384f;
+
+Camera make_camera(const Vec3& position, float mouseX, float mouseY, int width, int height, float aspect, float verticalFovDegrees)
+{
+    float yaw = PI * (2.0f * (mouseX / float(width)) - 1.0f);
+    float pitch = (PI * 0.5f) * (2.0f * (mouseY / float(height)) - 1.0f);
+    pitch = std::clamp(pitch, -PI * 0.5f, PI * 0.5f);
+    float cosYaw = std::cos(yaw);
+    float sinYaw = std::sin(yaw);
+    float cosPitch = std::cos(pitch);
+    float sinPitch = std::sin(pitch);
+    float tanHalfFov = std::tan(verticalFovDegrees * (PI / 360.0f));
+
+    // The columns of R_y(yaw) * R_x(pitch) applied to +x, +y and -z
+    Camera camera;
+    camera.position = position;
+    camera.right = Vec3(cosYaw, 0.0f, sinYaw) * (aspect * tanHalfFov);
+    camera.up = Vec3(sinPitch * sinYaw, cosPitch, -sinPitch * cosYaw) * tanHalfFov;
+    camera.forward = Vec3(cosPitch * sinYaw, -sinPitch, -cosPitch * cosYaw);
+    camera.invWidth = 1.0f / float(width);
+    camera.invHeight = 1.0f / float(height);
+    return camera;
+}
+
+Vec3 camera_ray_direction(const Camera& camera, float x, float y)
+{
+    float u = ((x + camera.jitterX) * camera.invWidth) * 2.0f - 1.0f;
+    float v = ((y + camera.jitterY) * camera.invHeight) * 2.0f - 1.0f;
+    return normalize(camera.forward + camera.right * u + camera.up * v);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vec3.h"
+
+// The view for one frame, computed once on the CPU from the cursor-driven
+// yaw and pitch: primary rays are forward plus the pixel's offset along
+// right and up, which already carry the field of view and aspect ratio. The
+// GPU backends read it from FrameBlock in raytrace.glsl and the CPU tracer
+// uses it directly, so both build rays from the same numbers.
+struct Camera
+{
+    Vec3 position;
+    Vec3 right;     // aspect * tan(fovY / 2) long
+    Vec3 up;        // tan(fovY / 2) long
+    Vec3 forward;   // unit
+    float invWidth, invHeight;
+    // Sub-pixel offset of this frame's sample, added to every pixel coordinate
+    float jitterX = 0.0f;
+    float jitterY = 0.0f;
+};
+
+const float defaultAspect = 16.0f / 9.0f;
+const float defaultVerticalFov = 90.0f;    // degrees
+
+// Yaw follows the cursor across the whole window width as one turn, pitch
+// across the height as half a turn, both zero at the window center.
+Camera make_camera(const Vec3& position, float mouseX, float mouseY, int width, int height,
+                   float aspect = defaultAspect, float verticalFovDegrees = defaultVerticalFov);
+
+// Unit world-space direction through window coordinates (x, y), counted in
+// pixels from the bottom-left corner (pixel centers at + 0.5), plus the jitter.
+Vec3 camera_ray_direction(const Camera& camera, float x, float y);
@@ -0,0 +1,35 @@
+#include "cpu_features.h"
+
+#if CPU_X86 && defined(_MSC_VER)
+#include <intrin.h>
+
+// CPUID feature bits plus the OS having enabled the wider register state
+static bool msvc_cpu_supports(CpuFeature feature)
+{
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave)
+        return false;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if (feature == CpuFeatureAvx2)
+        return fma && (info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+    return (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+}
+#endif
+
+bool cpu_supports(CpuFeature feature)
+{
+#if CPU_X86 && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (feature == CpuFeatureAvx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return __builtin_cpu_supports("avx512f");
+#elif CPU_X86 && defined(_MSC_VER)
+    return msvc_cpu_supports(feature);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Runtime CPU feature checks for the CPU tracer's SIMD kernels. On x86 the
+// kernels are compiled for their target with CPU_TARGET regardless of the
+// build's flags, and only called once cpu_supports says the CPU and OS can
+// run them, so one binary uses the widest kernels the host has.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#endif
+
+// GCC and Clang compile single functions for a wider target; MSVC always accepts the intrinsics
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_TARGET(features) __attribute__((target(features)))
+#else
+#define CPU_TARGET(features)
+#endif
+
+enum CpuFeature
+{
+    CpuFeatureAvx2,     // AVX2 together with FMA
+    CpuFeatureAvx512    // AVX-512F
+};
+
+bool cpu_supports(CpuFeature feature);
@@ -0,0 +1,985 @@
+#include "cpu_tracer.h"
+
+#include <bitset>
+#include <chrono>
+#include "cpu_features.h"
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+const int tileSize = 32;
+
+Camera make_cpu_camera(const CpuFrameParams& params)
+{
+    return make_camera(params.cameraPos, params.mouseX, params.mouseY, params.width, params.height, params.aspect);
+}
+
+Vec3 primary_ray_direction(const Camera& camera, int x, int y)
+{
+    // gl_FragCoord samples pixel centers
+    return camera_ray_direction(camera, float(x) + 0.5f, float(y) + 0.5f);
+}
+
+bool intersect_sphere(const Vec3& ro, const Vec3& rd, const Vec3& center, float radius, float& t)
+{
+    Vec3 oc = ro - center;
+
+    // rd is unit length, so a = 1 and the factors of 2 cancel
+    float b = dot(oc, rd);
+    float c = dot(oc, oc) - radius * radius;
+
+    float discriminant = b * b - c;
+
+    if (discriminant < 0.0f)
+        return false;
+
+    t = -b - std::sqrt(discriminant);
+    return t > 0.0f;
+}
+
+bool intersect_triangle(const Vec3& ro, const Vec3& rd, const Vec3& v0, const Vec3& edge1, const Vec3& edge2, float& t)
+{
+    Vec3 p = cross(rd, edge2);
+    float det = dot(edge1, p);
+    if (std::fabs(det) < 1e-8f)
+        return false;
+
+    float invDet = 1.0f / det;
+    Vec3 s = ro - v0;
+    float u = dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    Vec3 q = cross(s, edge1);
+    float v = dot(rd, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    t = dot(edge2, q) * invDet;
+    return t > 0.0f;
+}
+
+const float noHit = 1e30f;
+
+// Entry distance into a node's box, or noHit if it misses or starts beyond tHit
+static float intersect_node(const BvhNode& node, const Vec3& ro, const Vec3& invDir, float tHit)
+{
+    Vec3 t0 = (node.boundsMin - ro) * invDir;
+    Vec3 t1 = (node.boundsMax - ro) * invDir;
+    Vec3 tMin = min(t0, t1);
+    Vec3 tMax = max(t0, t1);
+    float tEnter = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+    float tExit = std::min(std::min(tMax.x, tMax.y), tMax.z);
+    return (tEnter <= tExit && tEnter < tHit) ? tEnter : noHit;
+}
+
+static void intersect_triangle_into(const Triangle& triangle, const Vec3& ro, const Vec3& rd, float& tHit, bool& hit)
+{
+    float t;
+    if (intersect_triangle(ro, rd, triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, t) && t < tHit)
+    {
+        tHit = t;
+        hit = true;
+    }
+}
+
+// Stack traversal shared by both levels. Leaves hand their primIndices range
+// to intersectLeaf(first, count, tHit, hit); tHit comes in as the closest hit so far.
+// Starting below the root lets ray packets hand subtrees to single rays.
+template <typename IntersectLeaf>
+static bool traverse_bvh(const Bvh& bvh, const Vec3& ro, const Vec3& rd, float& tHit, IntersectLeaf&& intersectLeaf, uint32_t root = 0)
+{
+    bool hit = false;
+    if (bvh.nodes.empty())
+        return false;
+
+    Vec3 invDir(1.0f / rd.x, 1.0f / rd.y, 1.0f / rd.z);
+    uint32_t stackNode[bvhMaxDepth];
+    float stackDist[bvhMaxDepth];
+    int stackSize = 0;
+    uint32_t node = root;
+    if (intersect_node(bvh.nodes[root], ro, invDir, tHit) == noHit)
+        return false;
+
+    while (true)
+    {
+        const BvhNode& current = bvh.nodes[node];
+        if (current.is_leaf())
+        {
+            intersectLeaf(current.leftFirst, current.count, tHit, hit);
+        }
+        else
+        {
+            // Visit the nearer child first, keep the other for later
+            uint32_t nearNode = node + 1;
+            uint32_t farNode = current.leftFirst;
+            float dNear = intersect_node(bvh.nodes[nearNode], ro, invDir, tHit);
+            float dFar = intersect_node(bvh.nodes[farNode], ro, invDir, tHit);
+            if (dFar < dNear)
+            {
+                std::swap(nearNode, farNode);
+                std::swap(dNear, dFar);
+            }
+            if (dNear != noHit)
+            {
+                if (dFar != noHit)
+                {
+                    stackNode[stackSize] = farNode;
+                    stackDist[stackSize] = dFar;
+                    stackSize++;
+                }
+                node = nearNode;
+                continue;
+            }
+        }
+
+        // Pop, skipping nodes that start beyond the closest hit found since they were pushed
+        bool found = false;
+        while (stackSize > 0)
+        {
+            stackSize--;
+            if (stackDist[stackSize] < tHit)
+            {
+                node = stackNode[stackSize];
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            break;
+    }
+    return hit;
+}
+
+// Wide version: one SIMD test per node covers all its children, and the hit
+// children are pushed far to near so the nearest is popped next.
+template <int Width, typename IntersectLeaf>
+static bool traverse_bvh(const Mbvh<Width>& mbvh, const Vec3& ro, const Vec3& rd, float& tHit, IntersectLeaf&& intersectLeaf)
+{
+    bool hit = false;
+    if (mbvh.nodes.empty())
+        return false;
+
+    struct Entry
+    {
+        uint32_t child;
+        uint32_t count;
+        float dist;
+    };
+    Vec3 invDir(1.0f / rd.x, 1.0f / rd.y, 1.0f / rd.z);
+    // Each level popped can leave up to Width - 1 siblings behind
+    Entry stack[bvhMaxDepth * (Width - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0, 0.0f };
+
+    while (stackSize > 0)
+    {
+        Entry entry = stack[--stackSize];
+        if (entry.dist >= tHit)
+            continue;
+        if (entry.count > 0)
+        {
+            intersectLeaf(entry.child, entry.count, tHit, hit);
+            continue;
+        }
+
+        const MbvhNode<Width>& node = mbvh.nodes[entry.child];
+        float tEnter[Width];
+        unsigned mask = intersect_children(node, ro, invDir, tHit, tEnter);
+        Entry hits[Width];
+        int hitCount = 0;
+        for (int i = 0; i < Width; i++)
+        {
+            if (!(mask & (1u << i)))
+                continue;
+            // Insertion sort, farthest first
+            Entry child = { node.child[i], node.count[i], tEnter[i] };
+            int j = hitCount++;
+            while (j > 0 && hits[j - 1].dist < child.dist)
+            {
+                hits[j] = hits[j - 1];
+                j--;
+            }
+            hits[j] = child;
+        }
+        for (int i = 0; i < hitCount; i++)
+        {
+            stack[stackSize++] = hits[i];
+        }
+    }
+    return hit;
+}
+
+// The object-space direction is left unnormalized so t stays a world-space distance.
+// With batch set, each mesh leaf is one call of the triangle kernel.
+template <typename Tree>
+static void intersect_instance(const Scene& scene, const std::vector<Tree>& meshTrees, const CpuSceneBvh* batch, const Instance& instance,
+                               const Vec3& ro, const Vec3& rd, float& tHit, bool& hit)
+{
+    Vec3 localOrigin = instance.worldToObject.point(ro);
+    Vec3 localDir = instance.worldToObject.vector(rd);
+    const std::vector<Triangle>& triangles = scene.meshes[instance.mesh].triangles;
+    const Tree& meshTree = meshTrees[instance.mesh];
+    TriangleRay localRay = make_triangle_ray(localOrigin, localDir);
+    if (traverse_bvh(meshTree, localOrigin, localDir, tHit, [&](uint32_t first, uint32_t count, float& t, bool& meshHit)
+        {
+            if (batch)
+            {
+                meshHit |= nearest_triangle(batch->meshTriangles[instance.mesh], first, count, localRay, t) >= 0;
+                return;
+            }
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                intersect_triangle_into(triangles[meshTree.primIndices[i]], localOrigin, localDir, t, meshHit);
+            }
+        }))
+    {
+        hit = true;
+    }
+}
+
+template <typename Tree>
+static void intersect_primitive(const Scene& scene, const std::vector<Tree>& meshTrees, const CpuSceneBvh* batch, uint32_t prim,
+                                const Vec3& ro, const Vec3& rd, float& tHit, bool& hit)
+{
+    float t;
+    size_t instanceBase = scene.spheres.size() + scene.triangles.size();
+    if (prim >= instanceBase)
+    {
+        intersect_instance(scene, meshTrees, batch, scene.instances[prim - instanceBase], ro, rd, tHit, hit);
+    }
+    else if (prim < scene.spheres.size())
+    {
+        const Sphere& sphere = scene.spheres[prim];
+        if (intersect_sphere(ro, rd, sphere.center, sphere.radius, t) && t < tHit)
+        {
+            tHit = t;
+            hit = true;
+        }
+    }
+    else
+    {
+        intersect_triangle_into(scene.triangles[prim - scene.spheres.size()], ro, rd, tHit, hit);
+    }
+}
+
+// Smaller leaves are cheaper tested one primitive at a time than through a
+// kernel call and its horizontal reduction
+static const uint32_t sphereBatchMinimum = 4;
+
+// Top-level leaf primIndices [first, first + count). With batch set, the
+// leaf's triangles and, in a large enough leaf, its spheres each go through
+// one call of their SIMD kernel; the other primitives are tested one at a time.
+template <typename Tree>
+static void intersect_leaf(const Scene& scene, const std::vector<Tree>& meshTrees, const std::vector<uint32_t>& primIndices, const CpuSceneBvh* batch,
+                           uint32_t first, uint32_t count, const TriangleRay& ray, float& tHit, bool& hit)
+{
+    const Vec3& ro = ray.origin;
+    const Vec3& rd = ray.direction;
+    if (!batch)
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            intersect_primitive(scene, meshTrees, batch, primIndices[i], ro, rd, tHit, hit);
+        }
+        return;
+    }
+
+    bool sphereBatch = count >= sphereBatchMinimum && !scene.spheres.empty();
+    if (sphereBatch && batch->nearestSphere(batch->leafSpheres, first, count, ro, rd, tHit) >= 0)
+    {
+        hit = true;
+    }
+    if (!scene.triangles.empty() && nearest_triangle(batch->leafTriangles, first, count, ray, tHit) >= 0)
+    {
+        hit = true;
+    }
+    size_t triangleBase = scene.spheres.size();
+    size_t instanceBase = triangleBase + scene.triangles.size();
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        uint32_t prim = primIndices[i];
+        if (prim < triangleBase ? !sphereBatch : prim >= instanceBase)
+        {
+            intersect_primitive(scene, meshTrees, batch, prim, ro, rd, tHit, hit);
+        }
+    }
+}
+
+template <typename Tree>
+static bool trace_tree(const Scene& scene, const Tree& top, const std::vector<Tree>& meshTrees, const CpuSceneBvh* batch,
+                       const Vec3& ro, const Vec3& rd, float& tHit)
+{
+    tHit = noHit;
+    TriangleRay ray = make_triangle_ray(ro, rd);
+    return traverse_bvh(top, ro, rd, tHit, [&](uint32_t first, uint32_t count, float& t, bool& hit)
+    {
+        intersect_leaf(scene, meshTrees, top.primIndices, batch, first, count, ray, t, hit);
+    });
+}
+
+bool trace_scene(const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs, const Vec3& ro, const Vec3& rd, float& tHit)
+{
+    return trace_tree(scene, bvh, meshBvhs, nullptr, ro, rd, tHit);
+}
+
+void update_cpu_scene_bvh(CpuSceneBvh& cpuBvh, const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs, bool meshes)
+{
+    cpuBvh.bvh = &bvh;
+    cpuBvh.meshBvhs = &meshBvhs;
+    // The wide trees share the binary tree's primIndices, so one layout serves every width
+    build_sphere_soa(scene, bvh.primIndices, cpuBvh.leafSpheres);
+    build_triangle_soa(scene.triangles, bvh.primIndices, static_cast<uint32_t>(scene.spheres.size()), cpuBvh.triangleTest, cpuBvh.leafTriangles);
+    if (meshes)
+    {
+        cpuBvh.meshTriangles.resize(meshBvhs.size());
+        for (size_t m = 0; m < meshBvhs.size(); m++)
+        {
+            build_triangle_soa(scene.meshes[m].triangles, meshBvhs[m].primIndices, 0, cpuBvh.triangleTest, cpuBvh.meshTriangles[m]);
+        }
+    }
+    if (!cpuBvh.nearestSphere)
+    {
+        cpuBvh.nearestSphere = nearest_sphere_function(cpuBvh.sphereKernel);
+    }
+    if (cpuBvh.width == 4)
+    {
+        cpuBvh.top4 = collapse_bvh<4>(bvh);
+        if (meshes)
+        {
+            cpuBvh.meshes4.clear();
+            for (const Bvh& meshBvh : meshBvhs)
+            {
+                cpuBvh.meshes4.push_back(collapse_bvh<4>(meshBvh));
+            }
+        }
+    }
+    else if (cpuBvh.width == 8)
+    {
+        cpuBvh.top8 = collapse_bvh<8>(bvh);
+        if (meshes)
+        {
+            cpuBvh.meshes8.clear();
+            for (const Bvh& meshBvh : meshBvhs)
+            {
+                cpuBvh.meshes8.push_back(collapse_bvh<8>(meshBvh));
+            }
+        }
+    }
+}
+
+bool trace_scene(const Scene& scene, const CpuSceneBvh& cpuBvh, const Vec3& ro, const Vec3& rd, float& tHit)
+{
+    switch (cpuBvh.width)
+    {
+    case 4: return trace_tree(scene, cpuBvh.top4, cpuBvh.meshes4, &cpuBvh, ro, rd, tHit);
+    case 8: return trace_tree(scene, cpuBvh.top8, cpuBvh.meshes8, &cpuBvh, ro, rd, tHit);
+    }
+    return trace_tree(scene, *cpuBvh.bvh, *cpuBvh.meshBvhs, &cpuBvh, ro, rd, tHit);
+}
+
+static bool intersect_triangle_with(TriangleTest test, const TriangleRay& ray, const Triangle& triangle, float& t)
+{
+    if (test == TriangleTestWatertight)
+        return intersect_triangle_watertight(ray, triangle.v0, triangle.v1, triangle.v2, t);
+    return intersect_triangle(ray.origin, ray.direction, triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, t);
+}
+
+bool trace_scene_hit(const Scene& scene, const CpuSceneBvh& cpuBvh, const Vec3& ro, const Vec3& rd, SceneHit& hit)
+{
+    const Bvh& bvh = *cpuBvh.bvh;
+    const std::vector<Bvh>& meshBvhs = *cpuBvh.meshBvhs;
+    size_t triangleBase = scene.spheres.size();
+    size_t instanceBase = triangleBase + scene.triangles.size();
+    TriangleRay ray = make_triangle_ray(ro, rd);
+    const Triangle* hitTriangle = nullptr;
+    hit.t = noHit;
+    hit.prim = UINT32_MAX;
+    traverse_bvh(bvh, ro, rd, hit.t, [&](uint32_t first, uint32_t count, float& tHit, bool& leafHit)
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            uint32_t prim = bvh.primIndices[i];
+            float t;
+            if (prim >= instanceBase)
+            {
+                const Instance& instance = scene.instances[prim - instanceBase];
+                const Mesh& mesh = scene.meshes[instance.mesh];
+                const Bvh& meshBvh = meshBvhs[instance.mesh];
+                TriangleRay localRay = make_triangle_ray(instance.worldToObject.point(ro), instance.worldToObject.vector(rd));
+                traverse_bvh(meshBvh, localRay.origin, localRay.direction, tHit, [&](uint32_t meshFirst, uint32_t meshCount, float& tMesh, bool& meshHit)
+                {
+                    for (uint32_t j = meshFirst; j < meshFirst + meshCount; j++)
+                    {
+                        const Triangle& triangle = mesh.triangles[meshBvh.primIndices[j]];
+                        if (intersect_triangle_with(cpuBvh.triangleTest, localRay, triangle, t) && t < tMesh)
+                        {
+                            tMesh = t;
+                            hit.prim = prim;
+                            hitTriangle = &triangle;
+                            meshHit = leafHit = true;
+                        }
+                    }
+                });
+            }
+            else if (prim < triangleBase)
+            {
+                const Sphere& sphere = scene.spheres[prim];
+                if (intersect_sphere(ro, rd, sphere.center, sphere.radius, t) && t < tHit)
+                {
+                    tHit = t;
+                    hit.prim = prim;
+                    hitTriangle = nullptr;
+                    leafHit = true;
+                }
+            }
+            else
+            {
+                const Triangle& triangle = scene.triangles[prim - triangleBase];
+                if (intersect_triangle_with(cpuBvh.triangleTest, ray, triangle, t) && t < tHit)
+                {
+                    tHit = t;
+                    hit.prim = prim;
+                    hitTriangle = &triangle;
+                    leafHit = true;
+                }
+            }
+        }
+    });
+    if (hit.prim == UINT32_MAX)
+        return false;
+
+    if (!hitTriangle)
+    {
+        hit.normal = normalize(ro + rd * hit.t - scene.spheres[hit.prim].center);
+        return true;
+    }
+    Vec3 normal = cross(hitTriangle->v1 - hitTriangle->v0, hitTriangle->v2 - hitTriangle->v0);
+    if (hit.prim >= instanceBase)
+    {
+        // Normals go through the inverse transpose: the transpose of world-to-object
+        const float (&m)[3][4] = scene.instances[hit.prim - instanceBase].worldToObject.m;
+        normal = Vec3(m[0][0] * normal.x + m[1][0] * normal.y + m[2][0] * normal.z,
+                      m[0][1] * normal.x + m[1][1] * normal.y + m[2][1] * normal.z,
+                      m[0][2] * normal.x + m[1][2] * normal.y + m[2][2] * normal.z);
+    }
+    hit.normal = normalize(normal);
+    return true;
+}
+
+static void shade_pixel(const Camera& camera, const Scene& scene, const CpuSceneBvh& cpuBvh, int x, int y, unsigned char* out)
+{
+    Vec3 rd = primary_ray_direction(camera, x, y);
+    float t;
+    bool hit = trace_scene(scene, cpuBvh, camera.position, rd, t);
+    out[0] = hit ? 255 : 0;
+    out[1] = 0;
+    out[2] = 0;
+}
+
+// Primary rays of a 4-pixel-wide block, one per lane, structure-of-arrays.
+// They all start at the camera, so a node's offset from the origin is shared
+// and the packet's corner rays bound every lane with a four-plane frustum.
+template <int Size>
+struct RayPacket
+{
+    static const int columns = 4;
+    static const int rows = Size / columns;
+
+    alignas(64) float dx[Size], dy[Size], dz[Size];
+    alignas(64) float ix[Size], iy[Size], iz[Size];
+    alignas(64) float tHit[Size];
+    Vec3 origin;
+    Vec3 frustumNormals[4];     // inward, planes through origin
+    uint32_t active = 0;        // lanes that map to a pixel inside the tile
+    uint32_t hits = 0;
+
+    Vec3 direction(int lane) const { return Vec3(dx[lane], dy[lane], dz[lane]); }
+};
+
+// Below this many live lanes a subtree is finished one ray at a time; the
+// SIMD box tests stop paying for themselves once most lanes are idle.
+template <int Size>
+static int packet_min_lanes()
+{
+    return Size / 4 + 1;
+}
+
+template <int Size>
+static void make_packet(const Camera& camera, int x0, int y0, int x1, int y1, RayPacket<Size>& packet)
+{
+    packet.origin = camera.position;
+    for (int lane = 0; lane < Size; lane++)
+    {
+        int x = x0 + lane % RayPacket<Size>::columns;
+        int y = y0 + lane / RayPacket<Size>::columns;
+        // Lanes past the tile edge still get a ray so the frustum stays a full block
+        Vec3 rd = primary_ray_direction(camera, x, y);
+        packet.dx[lane] = rd.x;
+        packet.dy[lane] = rd.y;
+        packet.dz[lane] = rd.z;
+        packet.ix[lane] = 1.0f / rd.x;
+        packet.iy[lane] = 1.0f / rd.y;
+        packet.iz[lane] = 1.0f / rd.z;
+        packet.tHit[lane] = noHit;
+        if (x < x1 && y < y1)
+        {
+            packet.active |= 1u << lane;
+        }
+    }
+
+    // Corners counter-clockwise; orient each plane towards the block's center ray
+    const int corners[4] = { 0, RayPacket<Size>::columns - 1, Size - 1, Size - RayPacket<Size>::columns };
+    Vec3 center = packet.direction(corners[0]) + packet.direction(corners[2]);
+    for (int i = 0; i < 4; i++)
+    {
+        Vec3 n = cross(packet.direction(corners[i]), packet.direction(corners[(i + 1) % 4]));
+        packet.frustumNormals[i] = dot(n, center) < 0.0f ? -n : n;
+    }
+}
+
+// False when the box lies entirely behind one of the frustum planes
+template <int Size>
+static bool frustum_overlaps(const RayPacket<Size>& packet, const BvhNode& node)
+{
+    Vec3 lo = node.boundsMin - packet.origin;
+    Vec3 hi = node.boundsMax - packet.origin;
+    for (const Vec3& n : packet.frustumNormals)
+    {
+        // Box corner farthest along the plane normal
+        Vec3 p(n.x > 0.0f ? hi.x : lo.x, n.y > 0.0f ? hi.y : lo.y, n.z > 0.0f ? hi.z : lo.z);
+        if (dot(n, p) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// The packet kernels below have an AVX2 version for 8 lanes at a time,
+// compiled in whatever the build's flags and used when the CPU has it
+#if CPU_X86
+static bool packet_avx2()
+{
+    static const bool supported = cpu_supports(CpuFeatureAvx2);
+    return supported;
+}
+#endif
+
+// Slab test of every lane against the box lo..hi, relative to the packet
+// origin. Writes each lane's entry distance and returns the lanes that enter
+// the box before their own closest hit.
+template <int Size>
+static uint32_t packet_slabs_scalar(const RayPacket<Size>& packet, const Vec3& lo, const Vec3& hi, float (&enter)[Size])
+{
+    uint32_t mask = 0;
+    for (int lane = 0; lane < Size; lane++)
+    {
+        float tx0 = lo.x * packet.ix[lane], tx1 = hi.x * packet.ix[lane];
+        float ty0 = lo.y * packet.iy[lane], ty1 = hi.y * packet.iy[lane];
+        float tz0 = lo.z * packet.iz[lane], tz1 = hi.z * packet.iz[lane];
+        float tEnter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+        float tExit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+        enter[lane] = tEnter;
+        mask |= (tEnter <= tExit && tEnter < packet.tHit[lane]) ? 1u << lane : 0u;
+    }
+    return mask;
+}
+
+#if CPU_X86
+template <int Size>
+CPU_TARGET("avx2")
+static uint32_t packet_slabs_avx2(const RayPacket<Size>& packet, const Vec3& lo, const Vec3& hi, float (&enter)[Size])
+{
+    uint32_t mask = 0;
+    __m256 loX = _mm256_set1_ps(lo.x), loY = _mm256_set1_ps(lo.y), loZ = _mm256_set1_ps(lo.z);
+    __m256 hiX = _mm256_set1_ps(hi.x), hiY = _mm256_set1_ps(hi.y), hiZ = _mm256_set1_ps(hi.z);
+    for (int c = 0; c < Size; c += 8)
+    {
+        __m256 ix = _mm256_load_ps(packet.ix + c), iy = _mm256_load_ps(packet.iy + c), iz = _mm256_load_ps(packet.iz + c);
+        __m256 tx0 = _mm256_mul_ps(loX, ix), tx1 = _mm256_mul_ps(hiX, ix);
+        __m256 ty0 = _mm256_mul_ps(loY, iy), ty1 = _mm256_mul_ps(hiY, iy);
+        __m256 tz0 = _mm256_mul_ps(loZ, iz), tz1 = _mm256_mul_ps(hiZ, iz);
+        __m256 tEnter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                                      _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+        __m256 tExit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_max_ps(tz0, tz1));
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tEnter, tExit, _CMP_LE_OQ),
+                                   _mm256_cmp_ps(tEnter, _mm256_load_ps(packet.tHit + c), _CMP_LT_OQ));
+        _mm256_store_ps(enter + c, tEnter);
+        mask |= static_cast<uint32_t>(_mm256_movemask_ps(hit)) << c;
+    }
+    return mask;
+}
+#endif
+
+// Slab test of every lane in lanes against one box. Returns the lanes that
+// enter it before their own closest hit and the nearest of their entry distances.
+template <int Size>
+static uint32_t intersect_packet(const RayPacket<Size>& packet, const BvhNode& node, uint32_t lanes, float& nearest)
+{
+    nearest = noHit;
+    if (!frustum_overlaps(packet, node))
+        return 0;
+
+    Vec3 lo = node.boundsMin - packet.origin;
+    Vec3 hi = node.boundsMax - packet.origin;
+    alignas(64) float enter[Size];
+#if CPU_X86
+    uint32_t mask = packet_avx2() ? packet_slabs_avx2(packet, lo, hi, enter) : packet_slabs_scalar(packet, lo, hi, enter);
+#else
+    uint32_t mask = packet_slabs_scalar(packet, lo, hi, enter);
+#endif
+    mask &= lanes;
+    for (int lane = 0; lane < Size; lane++)
+    {
+        if (mask & (1u << lane))
+        {
+            nearest = std::min(nearest, enter[lane]);
+        }
+    }
+    return mask;
+}
+
+// Sphere and triangle tests against every lane at once. With the origin
+// shared, everything that depends only on it and the primitive is computed
+// once per packet; the rest follows intersect_sphere and intersect_triangle.
+// Both return the lanes whose closest hit they moved.
+template <int Size>
+static uint32_t packet_sphere_scalar(RayPacket<Size>& packet, const Sphere& sphere, uint32_t lanes)
+{
+    uint32_t mask = 0;
+    for (int lane = 0; lane < Size; lane++)
+    {
+        float t;
+        if ((lanes & (1u << lane)) && intersect_sphere(packet.origin, packet.direction(lane), sphere.center, sphere.radius, t)
+            && t < packet.tHit[lane])
+        {
+            packet.tHit[lane] = t;
+            mask |= 1u << lane;
+        }
+    }
+    return mask;
+}
+
+#if CPU_X86
+// The lane directions are unit length, so as in intersect_sphere a = 1 and
+// only b depends on the lane
+template <int Size>
+CPU_TARGET("avx2")
+static uint32_t packet_sphere_avx2(RayPacket<Size>& packet, const Sphere& sphere, uint32_t lanes)
+{
+    uint32_t mask = 0;
+    Vec3 oc = packet.origin - sphere.center;
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    __m256 ocX = _mm256_set1_ps(oc.x), ocY = _mm256_set1_ps(oc.y), ocZ = _mm256_set1_ps(oc.z);
+    __m256 cLanes = _mm256_set1_ps(c);
+    for (int l = 0; l < Size; l += 8)
+    {
+        __m256 dx = _mm256_load_ps(packet.dx + l), dy = _mm256_load_ps(packet.dy + l), dz = _mm256_load_ps(packet.dz + l);
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocX, dx), _mm256_mul_ps(ocY, dy)), _mm256_mul_ps(ocZ, dz));
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), cLanes);
+        __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), _mm256_sqrt_ps(discriminant));
+        __m256 tHit = _mm256_load_ps(packet.tHit + l);
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                   _mm256_and_ps(_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(t, tHit, _CMP_LT_OQ)));
+        uint32_t laneMask = (static_cast<uint32_t>(_mm256_movemask_ps(hit)) << l) & lanes;
+        hit = _mm256_and_ps(hit, _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+            _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(lanes >> l)), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256())));
+        _mm256_store_ps(packet.tHit + l, _mm256_blendv_ps(tHit, t, hit));
+        mask |= laneMask;
+    }
+    return mask;
+}
+#endif
+
+template <int Size>
+static uint32_t packet_triangle_scalar(RayPacket<Size>& packet, const Triangle& triangle, uint32_t lanes)
+{
+    Vec3 edge1 = triangle.v1 - triangle.v0;
+    Vec3 edge2 = triangle.v2 - triangle.v0;
+    uint32_t mask = 0;
+    for (int lane = 0; lane < Size; lane++)
+    {
+        float t;
+        if ((lanes & (1u << lane)) && intersect_triangle(packet.origin, packet.direction(lane), triangle.v0, edge1, edge2, t)
+            && t < packet.tHit[lane])
+        {
+            packet.tHit[lane] = t;
+            mask |= 1u << lane;
+        }
+    }
+    return mask;
+}
+
+#if CPU_X86
+template <int Size>
+CPU_TARGET("avx2")
+static uint32_t packet_triangle_avx2(RayPacket<Size>& packet, const Triangle& triangle, uint32_t lanes)
+{
+    Vec3 edge1 = triangle.v1 - triangle.v0;
+    Vec3 edge2 = triangle.v2 - triangle.v0;
+    uint32_t mask = 0;
+    Vec3 s = packet.origin - triangle.v0;
+    Vec3 q = cross(s, edge1);
+    float tNumerator = dot(edge2, q);
+    __m256 e1X = _mm256_set1_ps(edge1.x), e1Y = _mm256_set1_ps(edge1.y), e1Z = _mm256_set1_ps(edge1.z);
+    __m256 e2X = _mm256_set1_ps(edge2.x), e2Y = _mm256_set1_ps(edge2.y), e2Z = _mm256_set1_ps(edge2.z);
+    __m256 sX = _mm256_set1_ps(s.x), sY = _mm256_set1_ps(s.y), sZ = _mm256_set1_ps(s.z);
+    __m256 qX = _mm256_set1_ps(q.x), qY = _mm256_set1_ps(q.y), qZ = _mm256_set1_ps(q.z);
+    __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for (int l = 0; l < Size; l += 8)
+    {
+        __m256 dx = _mm256_load_ps(packet.dx + l), dy = _mm256_load_ps(packet.dy + l), dz = _mm256_load_ps(packet.dz + l);
+        // p = cross(rd, edge2)
+        __m256 pX = _mm256_sub_ps(_mm256_mul_ps(dy, e2Z), _mm256_mul_ps(dz, e2Y));
+        __m256 pY = _mm256_sub_ps(_mm256_mul_ps(dz, e2X), _mm256_mul_ps(dx, e2Z));
+        __m256 pZ = _mm256_sub_ps(_mm256_mul_ps(dx, e2Y), _mm256_mul_ps(dy, e2X));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, pX), _mm256_mul_ps(e1Y, pY)), _mm256_mul_ps(e1Z, pZ));
+        __m256 invDet = _mm256_div_ps(one, det);
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, pX), _mm256_mul_ps(sY, pY)), _mm256_mul_ps(sZ, pZ)), invDet);
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qX), _mm256_mul_ps(dy, qY)), _mm256_mul_ps(dz, qZ)), invDet);
+        __m256 t = _mm256_mul_ps(_mm256_set1_ps(tNumerator), invDet);
+        __m256 tHit = _mm256_load_ps(packet.tHit + l);
+        __m256 hit = _mm256_cmp_ps(_mm256_and_ps(det, absMask), _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, tHit, _CMP_LT_OQ)));
+        hit = _mm256_and_ps(hit, _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+            _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(lanes >> l)), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256())));
+        _mm256_store_ps(packet.tHit + l, _mm256_blendv_ps(tHit, t, hit));
+        mask |= static_cast<uint32_t>(_mm256_movemask_ps(hit)) << l;
+    }
+    return mask;
+}
+#endif
+
+template <int Size>
+static uint32_t intersect_packet_sphere(RayPacket<Size>& packet, const Sphere& sphere, uint32_t lanes)
+{
+#if CPU_X86
+    if (packet_avx2())
+        return packet_sphere_avx2(packet, sphere, lanes);
+#endif
+    return packet_sphere_scalar(packet, sphere, lanes);
+}
+
+template <int Size>
+static uint32_t intersect_packet_triangle(RayPacket<Size>& packet, const Triangle& triangle, uint32_t lanes)
+{
+#if CPU_X86
+    if (packet_avx2())
+        return packet_triangle_avx2(packet, triangle, lanes);
+#endif
+    return packet_triangle_scalar(packet, triangle, lanes);
+}
+
+// Finishes the subtree at node for each lane separately
+template <int Size>
+static void trace_lanes(const Scene& scene, const CpuSceneBvh& cpuBvh, uint32_t node, uint32_t lanes, RayPacket<Size>& packet)
+{
+    const Bvh& bvh = *cpuBvh.bvh;
+    for (int lane = 0; lane < Size; lane++)
+    {
+        if (!(lanes & (1u << lane)))
+            continue;
+        Vec3 rd = packet.direction(lane);
+        TriangleRay ray = make_triangle_ray(packet.origin, rd);
+        bool laneHit = traverse_bvh(bvh, packet.origin, rd, packet.tHit[lane], [&](uint32_t first, uint32_t count, float& t, bool& hit)
+        {
+            intersect_leaf(scene, *cpuBvh.meshBvhs, bvh.primIndices, &cpuBvh, first, count, ray, t, hit);
+        }, node);
+        if (laneHit)
+        {
+            packet.hits |= 1u << lane;
+        }
+    }
+}
+
+// Depth-first packet traversal of the binary BVH, carrying the mask of lanes
+// still inside each node. Nodes are culled by the frustum before any lane
+// test, and visited nearest-first by the closest lane's entry distance.
+template <int Size>
+static void trace_packet(const Scene& scene, const CpuSceneBvh& cpuBvh, RayPacket<Size>& packet)
+{
+    const Bvh& bvh = *cpuBvh.bvh;
+    const std::vector<Bvh>& meshBvhs = *cpuBvh.meshBvhs;
+    if (bvh.nodes.empty())
+        return;
+
+    // Rays whose directions disagree in sign cross the frustum's apex planes; no shared culling
+    uint32_t signs[3] = {};
+    for (int lane = 0; lane < Size; lane++)
+    {
+        signs[0] |= packet.dx[lane] < 0.0f ? 2u : 1u;
+        signs[1] |= packet.dy[lane] < 0.0f ? 2u : 1u;
+        signs[2] |= packet.dz[lane] < 0.0f ? 2u : 1u;
+    }
+    if (signs[0] == 3u || signs[1] == 3u || signs[2] == 3u)
+    {
+        trace_lanes(scene, cpuBvh, 0, packet.active, packet);
+        return;
+    }
+
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t lanes;
+    };
+    Entry stack[bvhMaxDepth];
+    int stackSize = 0;
+    float dist;
+    uint32_t node = 0;
+    uint32_t lanes = intersect_packet(packet, bvh.nodes[0], packet.active, dist);
+
+    while (lanes)
+    {
+        const BvhNode& current = bvh.nodes[node];
+        bool descended = false;
+        // The packet triangle test is Moller-Trumbore, so watertight leaves go lane by lane
+        if (static_cast<int>(std::bitset<32>(lanes).count()) < packet_min_lanes<Size>()
+            || (current.is_leaf() && cpuBvh.triangleTest == TriangleTestWatertight))
+        {
+            trace_lanes(scene, cpuBvh, node, lanes, packet);
+        }
+        else if (current.is_leaf())
+        {
+            size_t triangleBase = scene.spheres.size();
+            size_t instanceBase = triangleBase + scene.triangles.size();
+            for (uint32_t i = 0; i < current.count; i++)
+            {
+                uint32_t prim = bvh.primIndices[current.leftFirst + i];
+                if (prim < triangleBase)
+                {
+                    packet.hits |= intersect_packet_sphere(packet, scene.spheres[prim], lanes);
+                }
+                else if (prim < instanceBase)
+                {
+                    packet.hits |= intersect_packet_triangle(packet, scene.triangles[prim - triangleBase], lanes);
+                }
+                else
+                {
+                    // Instances move rays into their own space; lanes go one at a time
+                    for (int lane = 0; lane < Size; lane++)
+                    {
+                        bool laneHit = false;
+                        if (lanes & (1u << lane))
+                        {
+                            intersect_instance(scene, meshBvhs, &cpuBvh, scene.instances[prim - instanceBase], packet.origin,
+                                               packet.direction(lane), packet.tHit[lane], laneHit);
+                        }
+                        packet.hits |= laneHit ? 1u << lane : 0u;
+                    }
+                }
+            }
+        }
+        else
+        {
+            uint32_t nearNode = node + 1;
+            uint32_t farNode = current.leftFirst;
+            float dNear, dFar;
+            uint32_t nearLanes = intersect_packet(packet, bvh.nodes[nearNode], lanes, dNear);
+            uint32_t farLanes = intersect_packet(packet, bvh.nodes[farNode], lanes, dFar);
+            if (dFar < dNear)
+            {
+                std::swap(nearNode, farNode);
+                std::swap(nearLanes, farLanes);
+            }
+            if (nearLanes)
+            {
+                if (farLanes)
+                {
+                    stack[stackSize++] = { farNode, farLanes };
+                }
+                node = nearNode;
+                lanes = nearLanes;
+                descended = true;
+            }
+            else if (farLanes)
+            {
+                node = farNode;
+                lanes = farLanes;
+                descended = true;
+            }
+        }
+        if (descended)
+            continue;
+
+        // Pop, retesting the saved lanes since their closest hits may have moved in front of the node
+        lanes = 0;
+        while (stackSize > 0 && !lanes)
+        {
+            stackSize--;
+            node = stack[stackSize].node;
+            lanes = intersect_packet(packet, bvh.nodes[node], stack[stackSize].lanes, dist);
+        }
+    }
+}
+
+// Renders the tile rows [y0, y1) and columns [x0, x1) as Size-ray packets
+template <int Size>
+static void shade_tile_packets(const Camera& camera, const Scene& scene, const CpuSceneBvh& cpuBvh,
+                               int x0, int y0, int x1, int y1, int width, unsigned char* rgb)
+{
+    for (int by = y0; by < y1; by += RayPacket<Size>::rows)
+    {
+        for (int bx = x0; bx < x1; bx += RayPacket<Size>::columns)
+        {
+            RayPacket<Size> packet;
+            make_packet(camera, bx, by, x1, y1, packet);
+            trace_packet(scene, cpuBvh, packet);
+            for (int lane = 0; lane < Size; lane++)
+            {
+                if (!(packet.active & (1u << lane)))
+                    continue;
+                int x = bx + lane % RayPacket<Size>::columns;
+                int y = by + lane / RayPacket<Size>::columns;
+                unsigned char* out = rgb + (static_cast<size_t>(y) * width + x) * 3;
+                out[0] = (packet.hits & (1u << lane)) ? 255 : 0;
+                out[1] = 0;
+                out[2] = 0;
+            }
+        }
+    }
+}
+
+CpuRenderStats cpu_render_frame(const CpuFrameParams& params, const Scene& scene, const CpuSceneBvh& cpuBvh,
+                                ThreadPool& pool, std::vector<unsigned char>& rgb)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    rgb.resize(static_cast<size_t>(params.width) * params.height * 3);
+
+    Camera camera = make_cpu_camera(params);
+    int tilesX = (params.width + tileSize - 1) / tileSize;
+    int tilesY = (params.height + tileSize - 1) / tileSize;
+
+    pool.parallel_for(tilesX * tilesY, [&](int tile)
+    {
+        int x0 = (tile % tilesX) * tileSize;
+        int y0 = (tile / tilesX) * tileSize;
+        int x1 = std::min(x0 + tileSize, params.width);
+        int y1 = std::min(y0 + tileSize, params.height);
+        if (params.packetSize == 8)
+        {
+            shade_tile_packets<8>(camera, scene, cpuBvh, x0, y0, x1, y1, params.width, rgb.data());
+            return;
+        }
+        if (params.packetSize == 16)
+        {
+            shade_tile_packets<16>(camera, scene, cpuBvh, x0, y0, x1, y1, params.width, rgb.data());
+            return;
+        }
+        for (int y = y0; y < y1; y++)
+        {
+            unsigned char* row = rgb.data() + (static_cast<size_t>(y) * params.width) * 3;
+            for (int x = x0; x < x1; x++)
+            {
+                shade_pixel(camera, scene, cpuBvh, x, y, row + x * 3);
+            }
+        }
+    });
+
+    CpuRenderStats stats;
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    stats.rays = static_cast<long long>(params.width) * params.height;
+    return stats;
+}
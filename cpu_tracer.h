@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include "vec3.h"
+#include "camera.h"
+#include "thread_pool.h"
+#include "scene.h"
+#include "bvh.h"
+#include "mbvh.h"
+#include "sphere_kernel.h"
+#include "triangle_kernel.h"
+
+// CPU reference renderer. Mirrors shadePixel() in raytrace.glsl so its output
+// can be diffed against the GPU image and timed on machines without a GPU.
+
+struct CpuFrameParams
+{
+    int width;
+    int height;
+    float mouseX, mouseY;
+    Vec3 cameraPos;
+    float aspect = defaultAspect;
+    // 8 or 16 traces primary rays as 4x2 or 4x4 pixel packets through the
+    // binary BVH; 0 traces every pixel on its own through cpuBvh's width.
+    int packetSize = 0;
+    // Relative error at which the path tracer's tiles stop taking samples
+    // (adaptive.h); 0 samples every pixel every frame.
+    float adaptiveError = 0.0f;
+};
+
+struct CpuRenderStats
+{
+    double milliseconds;
+    long long rays;
+};
+
+Camera make_cpu_camera(const CpuFrameParams& params);
+
+// World-space direction through the center of pixel (x, y), y counted from the bottom.
+Vec3 primary_ray_direction(const Camera& camera, int x, int y);
+
+bool intersect_sphere(const Vec3& ro, const Vec3& rd, const Vec3& center, float radius, float& t);
+bool intersect_triangle(const Vec3& ro, const Vec3& rd, const Vec3& v0, const Vec3& edge1, const Vec3& edge2, float& t);
+
+// Nearest hit through the BVH, visiting nodes in the same order as traceScene in the shader.
+// Instance leaves continue into meshBvhs[instance.mesh] with the ray in object space.
+bool trace_scene(const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs, const Vec3& ro, const Vec3& rd, float& tHit);
+
+// What the CPU tracer traverses: the binary top-level and mesh BVHs as built,
+// plus wide copies collapsed from them when width is 4 or 8.
+struct CpuSceneBvh
+{
+    int width = 2;
+    const Bvh* bvh = nullptr;
+    const std::vector<Bvh>* meshBvhs = nullptr;
+    Mbvh<4> top4;
+    std::vector<Mbvh<4>> meshes4;
+    Mbvh<8> top8;
+    std::vector<Mbvh<8>> meshes8;
+    // Top-level leaf spheres in primIndices order, so each leaf's spheres
+    // are tested by one call of the batch kernel
+    SphereKernel sphereKernel = best_sphere_kernel();
+    SphereSoA leafSpheres;
+    NearestSphereFn nearestSphere = nullptr;
+    // Loose triangles in the same order, and each mesh's in its BVH's order,
+    // with precomputed edges or vertices depending on triangleTest
+    TriangleTest triangleTest = TriangleTestMollerTrumbore;
+    TriangleSoA leafTriangles;
+    std::vector<TriangleSoA> meshTriangles;
+};
+
+// Points cpuBvh at the binary trees, collapses the wide copies for its width
+// and lays out the leaf spheres and triangles. Call again after every refit
+// or rebuild of bvh, with meshes = false since the mesh BVHs never change.
+void update_cpu_scene_bvh(CpuSceneBvh& cpuBvh, const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs, bool meshes);
+
+// Nearest hit through whichever tree width cpuBvh selects. The wide trees
+// visit children front to back but not in the shader's order, so ties between
+// equally distant primitives may resolve differently; the distance does not.
+bool trace_scene(const Scene& scene, const CpuSceneBvh& cpuBvh, const Vec3& ro, const Vec3& rd, float& tHit);
+
+// What trace_scene_hit found: a primitive id in primIndices terms and the
+// unit world-space geometric normal as wound, like traceSceneHit and
+// hitNormal in the shaders.
+struct SceneHit
+{
+    float t;
+    uint32_t prim;
+    Vec3 normal;
+};
+
+// Nearest hit through cpuBvh's binary trees with what was hit, for shading.
+// Uses cpuBvh's triangle test but none of its wide or batch paths.
+bool trace_scene_hit(const Scene& scene, const CpuSceneBvh& cpuBvh, const Vec3& ro, const Vec3& rd, SceneHit& hit);
+
+// Renders into rgb (bottom-to-top rows, 3 bytes per pixel) using one tile per pool job.
+CpuRenderStats cpu_render_frame(const CpuFrameParams& params, const Scene& scene, const CpuSceneBvh& cpuBvh,
+                                ThreadPool& pool, std::vector<unsigned char>& rgb);
@@ -0,0 +1,169 @@
+#include "frame_state.h"
+
+#include <cstddef>
+#include <cstring>
+
+static_assert(offsetof(FrameState, pixelSize) == 64 && offsetof(FrameState, sphereCount) == 80
+              && offsetof(FrameState, sampleJitter) == 96 && offsetof(FrameState, historyMode) == 108
+              && offsetof(FrameState, previousCameraPos) == 112 && sizeof(FrameState) == 176,
+              "FrameState must match the std140 layout of FrameBlock");
+
+// Byte range of each group, in Group order
+static const size_t groupBegin[] = { 0, offsetof(FrameState, pixelSize), offsetof(FrameState, sphereCount), offsetof(FrameState, sampleJitter),
+                                     offsetof(FrameState, historyMode) };
+static const size_t groupEnd[] = { offsetof(FrameState, pixelSize), offsetof(FrameState, sphereCount), offsetof(FrameState, sampleJitter),
+                                   offsetof(FrameState, historyMode), sizeof(FrameState) };
+
+void FrameStateBuffer::init()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    slotStride = (sizeof(FrameState) + alignment - 1) / alignment * alignment;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, slotCount * slotStride, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapNamedBufferRange(buffer, 0, slotCount * slotStride, flags));
+
+    // Every group starts out newer than every slot, so the first bind writes all of it
+    for (uint32_t& v : version)
+    {
+        v = 1;
+    }
+}
+
+void FrameStateBuffer::release()
+{
+    for (GLsync& sync : inFlight)
+    {
+        if (sync)
+        {
+            glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(sync);
+            sync = nullptr;
+        }
+    }
+    if (buffer)
+    {
+        glUnmapNamedBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+    }
+}
+
+void FrameStateBuffer::update(Group group, const FrameState& next)
+{
+    const unsigned char* from = reinterpret_cast<const unsigned char*>(&next) + groupBegin[group];
+    unsigned char* to = reinterpret_cast<unsigned char*>(&state) + groupBegin[group];
+    size_t size = groupEnd[group] - groupBegin[group];
+    if (std::memcmp(from, to, size) != 0)
+    {
+        std::memcpy(to, from, size);
+        version[group]++;
+    }
+}
+
+static void copy_camera(const Camera& camera, float (&position)[4], float (&right)[4], float (&up)[4], float (&forward)[4])
+{
+    const Vec3* vectors[4] = { &camera.position, &camera.right, &camera.up, &camera.forward };
+    float* fields[4] = { position, right, up, forward };
+    for (int i = 0; i < 4; i++)
+    {
+        fields[i][0] = vectors[i]->x;
+        fields[i][1] = vectors[i]->y;
+        fields[i][2] = vectors[i]->z;
+        fields[i][3] = 0.0f;
+    }
+}
+
+void FrameStateBuffer::set_camera(const Camera& camera)
+{
+    FrameState next = state;
+    copy_camera(camera, next.cameraPos, next.cameraRight, next.cameraUp, next.cameraForward);
+    update(CameraGroup, next);
+}
+
+void FrameStateBuffer::set_window(int width, int height)
+{
+    FrameState next = state;
+    next.pixelSize[0] = 1.0f / float(width);
+    next.pixelSize[1] = 1.0f / float(height);
+    next.windowWidth = width;
+    next.windowHeight = height;
+    update(WindowGroup, next);
+}
+
+void FrameStateBuffer::set_scene(int sphereCount, int triangleCount, int nodeCount, bool watertightTriangles)
+{
+    FrameState next = state;
+    next.sphereCount = sphereCount;
+    next.triangleCount = triangleCount;
+    next.nodeCount = nodeCount;
+    next.watertightTriangles = watertightTriangles ? 1 : 0;
+    update(SceneGroup, next);
+}
+
+void FrameStateBuffer::set_sample(int sampleCount, float jitterX, float jitterY)
+{
+    FrameState next = state;
+    next.sampleJitter[0] = jitterX;
+    next.sampleJitter[1] = jitterY;
+    next.sampleCount = sampleCount;
+    update(SampleGroup, next);
+}
+
+void FrameStateBuffer::set_history(AccumulationHistory mode, const Camera& previousCamera)
+{
+    FrameState next = state;
+    next.historyMode = mode;
+    copy_camera(previousCamera, next.previousCameraPos, next.previousCameraRight, next.previousCameraUp, next.previousCameraForward);
+    update(HistoryGroup, next);
+}
+
+void FrameStateBuffer::bind()
+{
+    bool current = slot >= 0;
+    for (int g = 0; g < GroupCount && current; g++)
+    {
+        current = slotVersion[slot][g] == version[g];
+    }
+
+    if (current)
+    {
+        slotReuses++;
+    }
+    else
+    {
+        slot = (slot + 1) % slotCount;
+        if (inFlight[slot])
+        {
+            glClientWaitSync(inFlight[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(inFlight[slot]);
+            inFlight[slot] = nullptr;
+        }
+        unsigned char* out = mapped + slot * slotStride;
+        for (int g = 0; g < GroupCount; g++)
+        {
+            if (slotVersion[slot][g] == version[g])
+                continue;
+            size_t size = groupEnd[g] - groupBegin[g];
+            std::memcpy(out + groupBegin[g], reinterpret_cast<const unsigned char*>(&state) + groupBegin[g], size);
+            slotVersion[slot][g] = version[g];
+            bytesWritten += size;
+        }
+        slotWrites++;
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, buffer, slot * slotStride, sizeof(FrameState));
+}
+
+void FrameStateBuffer::fence()
+{
+    if (slot < 0)
+        return;
+    if (inFlight[slot])
+    {
+        glDeleteSync(inFlight[slot]);
+    }
+    inFlight[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
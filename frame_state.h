@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <glad/glad.h>
+#include "camera.h"
+#include "accumulation.h"
+
+// Everything the shaders read that stays fixed for a whole frame, laid out
+// as the std140 uniform block FrameBlock in raytrace.glsl.
+struct FrameState
+{
+    float cameraPos[4];
+    float cameraRight[4];
+    float cameraUp[4];
+    float cameraForward[4];
+    float pixelSize[2];
+    int32_t windowWidth;
+    int32_t windowHeight;
+    int32_t sphereCount;
+    int32_t triangleCount;
+    int32_t nodeCount;
+    int32_t watertightTriangles;
+    float sampleJitter[2];
+    int32_t sampleCount;
+    int32_t historyMode;
+    float previousCameraPos[4];
+    float previousCameraRight[4];
+    float previousCameraUp[4];
+    float previousCameraForward[4];
+};
+
+// FrameState in a persistently mapped ring of slotCount uniform buffer
+// slots, so the CPU writes frame N + 1 while the GPU still reads frame N.
+// The setters only mark a group of fields dirty when its value actually
+// changes, and each slot remembers which version of every group it holds:
+// a frame with nothing new rebinds the current slot without writing, and
+// a new slot only receives the groups that changed since it was last
+// written. A slot is reused once the fence of the last frame reading it
+// has passed. init and release need a current GL context.
+class FrameStateBuffer
+{
+public:
+    static const int slotCount = 3;
+
+    void init();
+    void release();
+
+    void set_camera(const Camera& camera);
+    void set_window(int width, int height);
+    void set_scene(int sphereCount, int triangleCount, int nodeCount, bool watertightTriangles);
+    void set_sample(int sampleCount, float jitterX, float jitterY);
+    // How the shaders use the accumulation history, and the camera it was traced with
+    void set_history(AccumulationHistory mode, const Camera& previousCamera);
+
+    // Writes the dirty groups into the next slot, if there are any, and binds
+    // the current slot to uniform binding 0. Call before the frame's draws.
+    void bind();
+    // Call after the frame's draws so the slot is not overwritten under them.
+    void fence();
+
+    long long bytes_written() const { return bytesWritten; }
+    int slot_writes() const { return slotWrites; }
+    int slot_reuses() const { return slotReuses; }
+
+private:
+    enum Group
+    {
+        CameraGroup,
+        WindowGroup,
+        SceneGroup,
+        SampleGroup,
+        HistoryGroup,
+        GroupCount
+    };
+
+    void update(Group group, const FrameState& next);
+
+    FrameState state = {};
+    uint32_t version[GroupCount] = {};
+    uint32_t slotVersion[slotCount][GroupCount] = {};
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t slotStride = 0;
+    int slot = -1;
+    GLsync inFlight[slotCount] = {};
+    long long bytesWritten = 0;
+    int slotWrites = 0;
+    int slotReuses = 0;
+};
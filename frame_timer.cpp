@@ -0,0 +1,87 @@
+#include "frame_timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+FrameTimer::FrameTimer(size_t capacity) : samples(std::max<size_t>(capacity, 1))
+{
+}
+
+void FrameTimer::begin_frame()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (started)
+    {
+        add_sample(std::chrono::duration<double, std::milli>(now - lastFrame).count());
+    }
+    started = true;
+    lastFrame = now;
+}
+
+void FrameTimer::add_sample(double milliseconds)
+{
+    samples[next] = milliseconds;
+    next = (next + 1) % samples.size();
+    filled = std::min(filled + 1, samples.size());
+}
+
+void FrameTimer::reset()
+{
+    next = 0;
+    filled = 0;
+    started = false;
+}
+
+// Nearest-rank percentile over an already sorted range
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+TimingStats FrameTimer::stats() const
+{
+    TimingStats result = {};
+    result.count = filled;
+    if (filled == 0)
+    {
+        return result;
+    }
+
+    std::vector<double> sorted(samples.begin(), samples.begin() + filled);
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0;
+    for (double sample : sorted)
+    {
+        sum += sample;
+    }
+    result.minMs = sorted.front();
+    result.meanMs = sum / filled;
+    result.p50Ms = percentile(sorted, 0.50);
+    result.p95Ms = percentile(sorted, 0.95);
+    result.p99Ms = percentile(sorted, 0.99);
+    result.maxMs = sorted.back();
+    return result;
+}
+
+bool write_timing_csv(const std::string& path, const std::vector<NamedTimingStats>& series)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open " << path << " for writing\n";
+        return false;
+    }
+
+    file << "name,count,min_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+    for (const NamedTimingStats& entry : series)
+    {
+        const TimingStats& s = entry.stats;
+        file << entry.name << "," << s.count << "," << s.minMs << "," << s.meanMs << ","
+             << s.p50Ms << "," << s.p95Ms << "," << s.p99Ms << "," << s.maxMs << "\n";
+    }
+    return file.good();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct TimingStats
+{
+    size_t count;
+    double minMs;
+    double meanMs;
+    double p50Ms;
+    double p95Ms;
+    double p99Ms;
+    double maxMs;
+};
+
+// Wall-clock frame durations in a fixed-size ring buffer, so long runs keep a
+// bounded window of recent frames. add_sample accepts durations measured
+// elsewhere (e.g. GPU queries) so every series shares the same statistics.
+class FrameTimer
+{
+public:
+    explicit FrameTimer(size_t capacity = 4096);
+
+    // Call once per frame; records the time elapsed since the previous call.
+    void begin_frame();
+    void add_sample(double milliseconds);
+    void reset();
+
+    TimingStats stats() const;
+    size_t sample_count() const { return filled; }
+    // The most recent sample, 0 before the first
+    double latest() const { return filled ? samples[(next + samples.size() - 1) % samples.size()] : 0.0; }
+
+private:
+    std::vector<double> samples;
+    size_t next = 0;
+    size_t filled = 0;
+    bool started = false;
+    std::chrono::steady_clock::time_point lastFrame;
+};
+
+struct NamedTimingStats
+{
+    std::string name;
+    TimingStats stats;
+};
+
+// One row per series: name,count,min_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms
+bool write_timing_csv(const std::string& path, const std::vector<NamedTimingStats>& series);
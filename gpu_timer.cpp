@@ -0,0 +1,74 @@
+#include "gpu_timer.h"
+
+void GpuTimer::init()
+{
+    glGenQueries(queryCount, startQueries);
+    glGenQueries(queryCount, endQueries);
+}
+
+void GpuTimer::release()
+{
+    glDeleteQueries(queryCount, startQueries);
+    glDeleteQueries(queryCount, endQueries);
+}
+
+void GpuTimer::begin()
+{
+    if (pending[current])
+    {
+        // Every slot is still in flight; skip timing this pass
+        return;
+    }
+    glQueryCounter(startQueries[current], GL_TIMESTAMP);
+    active = true;
+}
+
+void GpuTimer::end()
+{
+    if (!active)
+    {
+        return;
+    }
+    glQueryCounter(endQueries[current], GL_TIMESTAMP);
+    pending[current] = true;
+    current = (current + 1) % queryCount;
+    active = false;
+}
+
+static double read_elapsed_ms(GLuint startQuery, GLuint endQuery)
+{
+    GLuint64 startNs = 0, endNs = 0;
+    glGetQueryObjectui64v(startQuery, GL_QUERY_RESULT, &startNs);
+    glGetQueryObjectui64v(endQuery, GL_QUERY_RESULT, &endNs);
+    return (endNs - startNs) / 1.0e6;
+}
+
+int GpuTimer::collect(FrameTimer& samples)
+{
+    // Results complete in submission order, so stop at the first unfinished one
+    int collected = 0;
+    while (pending[oldest])
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(endQueries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            break;
+        }
+        samples.add_sample(read_elapsed_ms(startQueries[oldest], endQueries[oldest]));
+        pending[oldest] = false;
+        oldest = (oldest + 1) % queryCount;
+        collected++;
+    }
+    return collected;
+}
+
+void GpuTimer::drain(FrameTimer& samples)
+{
+    while (pending[oldest])
+    {
+        samples.add_sample(read_elapsed_ms(startQueries[oldest], endQueries[oldest]));
+        pending[oldest] = false;
+        oldest = (oldest + 1) % queryCount;
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "frame_timer.h"
+
+// GL_TIMESTAMP query pairs around a GPU pass, rotated over several slots so a
+// result is only read once the GPU has finished with it. If every slot is
+// still in flight the frame goes untimed rather than stalling. Timestamp pairs
+// rather than GL_TIME_ELAPSED because Mesa llvmpipe reports an absolute time
+// for the first elapsed query.
+// init and release need a current GL context.
+class GpuTimer
+{
+public:
+    static const int queryCount = 3;
+
+    void init();
+    void release();
+
+    void begin();
+    void end();
+
+    // Moves finished results into samples without blocking; returns how many.
+    int collect(FrameTimer& samples);
+    // Waits for all outstanding queries; use at shutdown.
+    void drain(FrameTimer& samples);
+
+private:
+    GLuint startQueries[queryCount];
+    GLuint endQueries[queryCount];
+    bool pending[queryCount] = {};
+    int current = 0;
+    int oldest = 0;
+    bool active = false;
+};
@@ -0,0 +1,124 @@
+#include "headless.h"
+#include "image.h"
+
+#include <iostream>
+#include <vector>
+#include <glad/glad.h>
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint fbo, colorTexture;
+static int targetWidth, targetHeight;
+
+static EGLDisplay get_surfaceless_display()
+{
+    // Prefer the surfaceless platform so no X11/Wayland server or DRM node is needed
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+    {
+        EGLDisplay surfaceless = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (surfaceless != EGL_NO_DISPLAY)
+        {
+            return surfaceless;
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool headless_init(int width, int height)
+{
+    display = get_surfaceless_display();
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        std::cerr << "Failed to initialize EGL display\n";
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cerr << "EGL does not support desktop OpenGL\n";
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT)
+    {
+        std::cerr << "Failed to create EGL context (0x" << std::hex << eglGetError() << std::dec << ")\n";
+        return false;
+    }
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        std::cerr << "Failed to make EGL context current\n";
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cerr << "Failed to initialize GLAD\n";
+        return false;
+    }
+
+    targetWidth = width;
+    targetHeight = height;
+
+    glGenTextures(1, &colorTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Offscreen framebuffer is incomplete\n";
+        return false;
+    }
+
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+void headless_shutdown()
+{
+    if (context != EGL_NO_CONTEXT)
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &colorTexture);
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        context = EGL_NO_CONTEXT;
+    }
+    if (display != EGL_NO_DISPLAY)
+    {
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+    }
+}
+
+void headless_bind_target()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, targetWidth, targetHeight);
+}
+
+bool headless_save_frame(const std::string& path)
+{
+    std::vector<unsigned char> pixels(static_cast<size_t>(targetWidth) * targetHeight * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, targetWidth, targetHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    return write_ppm(path, targetWidth, targetHeight, pixels);
+}
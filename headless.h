@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+// Offscreen rendering without a window: a surfaceless EGL context plus an FBO
+// that stands in for the default framebuffer. Works on Mesa llvmpipe.
+
+bool headless_init(int width, int height);
+void headless_shutdown();
+
+// Binds the offscreen framebuffer as the draw target.
+void headless_bind_target();
+
+// Reads back the offscreen color buffer and writes it as a binary PPM.
+bool headless_save_frame(const std::string& path);
@@ -0,0 +1,29 @@
+#include "image.h"
+
+#include <iostream>
+#include <fstream>
+
+bool write_ppm(const std::string& path, int width, int height, const std::vector<unsigned char>& rgb)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open " << path << " for writing\n";
+        return false;
+    }
+
+    // PPM rows run top to bottom, GL rows bottom to top
+    file << "P6\n" << width << " " << height << "\n255\n";
+    const size_t rowSize = static_cast<size_t>(width) * 3;
+    for (int y = height - 1; y >= 0; y--)
+    {
+        file.write(reinterpret_cast<const char*>(rgb.data() + y * rowSize), rowSize);
+    }
+    file.close();
+    if (!file)
+    {
+        std::cerr << "Could not write " << path << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Writes tightly packed 8-bit RGB as a binary PPM. Rows are expected bottom to
+// top, the order glReadPixels and the CPU tracer produce them in.
+bool write_ppm(const std::string& path, int width, int height, const std::vector<unsigned char>& rgb);
@@ -0,0 +1,301 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Morton-ordered ranges this small become leaves
+const uint32_t lbvhLeafSize = 4;
+// Above this many primitives 10 bits per axis leave too many duplicate codes
+const size_t lbvhWideKeyThreshold = 1 << 20;
+
+static int leading_zeros(uint64_t x)
+{
+    if (x == 0)
+        return 64;
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<int>(index);
+#else
+    int n = 0;
+    for (uint64_t bit = 1ull << 63; !(x & bit); bit >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+// Spreads the low 10 bits of v so there are two zero bits between each
+static uint32_t expand_bits_10(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Same for the low 21 bits into a 64-bit word
+static uint64_t expand_bits_21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffull;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+static uint32_t morton_code(const Vec3& unit, uint32_t)
+{
+    auto quantize = [](float f) { return static_cast<uint32_t>(std::min(std::max(f * 1024.0f, 0.0f), 1023.0f)); };
+    return (expand_bits_10(quantize(unit.x)) << 2) | (expand_bits_10(quantize(unit.y)) << 1) | expand_bits_10(quantize(unit.z));
+}
+
+static uint64_t morton_code(const Vec3& unit, uint64_t)
+{
+    auto quantize = [](float f) { return static_cast<uint64_t>(std::min(std::max(f * 2097152.0f, 0.0f), 2097151.0f)); };
+    return (expand_bits_21(quantize(unit.x)) << 2) | (expand_bits_21(quantize(unit.y)) << 1) | expand_bits_21(quantize(unit.z));
+}
+
+// LSD radix sort on 8-bit digits. Each pass builds per-chunk histograms in
+// parallel, turns them into scatter offsets, then scatters chunks in parallel;
+// chunks keep their relative order so every pass is stable.
+template <typename Key>
+static void radix_sort(std::vector<Key>& keys, std::vector<uint32_t>& values, int keyBits, ThreadPool& pool)
+{
+    const size_t n = keys.size();
+    const int chunks = static_cast<int>(std::min<size_t>(pool.size() * 4, (n + 4095) / 4096));
+    const size_t chunkSize = (n + chunks - 1) / chunks;
+    std::vector<Key> keysOut(n);
+    std::vector<uint32_t> valuesOut(n);
+    std::vector<size_t> offsets(static_cast<size_t>(chunks) * 256);
+
+    for (int shift = 0; shift < keyBits; shift += 8)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        pool.parallel_for(chunks, [&](int chunk)
+        {
+            size_t* histogram = &offsets[static_cast<size_t>(chunk) * 256];
+            size_t end = std::min(n, (chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < end; i++)
+            {
+                histogram[(keys[i] >> shift) & 0xff]++;
+            }
+        });
+
+        size_t sum = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            for (int chunk = 0; chunk < chunks; chunk++)
+            {
+                size_t& slot = offsets[static_cast<size_t>(chunk) * 256 + digit];
+                size_t count = slot;
+                slot = sum;
+                sum += count;
+            }
+        }
+
+        pool.parallel_for(chunks, [&](int chunk)
+        {
+            size_t* cursor = &offsets[static_cast<size_t>(chunk) * 256];
+            size_t end = std::min(n, (chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < end; i++)
+            {
+                size_t slot = cursor[(keys[i] >> shift) & 0xff]++;
+                keysOut[slot] = keys[i];
+                valuesOut[slot] = values[i];
+            }
+        });
+
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
+
+// Binary radix tree over sorted codes (Karras 2012). Internal node i has
+// children that are either leaves (sorted primitive positions) or internal nodes.
+struct RadixNode
+{
+    uint32_t child[2];
+    bool childIsLeaf[2];
+    uint32_t first, last;
+};
+
+template <typename Key>
+static void build_radix_tree(const std::vector<Key>& codes, int keyBits, std::vector<RadixNode>& tree, ThreadPool& pool)
+{
+    const int64_t n = static_cast<int64_t>(codes.size());
+    // Common prefix length of codes i and j, falling back to the index for equal codes
+    auto delta = [&](int64_t i, int64_t j) -> int
+    {
+        if (j < 0 || j >= n)
+            return -1;
+        if (codes[i] == codes[j])
+            return keyBits + leading_zeros(static_cast<uint64_t>(i ^ j)) - 32;
+        return leading_zeros(static_cast<uint64_t>(codes[i] ^ codes[j])) - (64 - keyBits);
+    };
+
+    tree.resize(static_cast<size_t>(n - 1));
+    const int chunkSize = 1024;
+    pool.parallel_for(static_cast<int>((n - 1 + chunkSize - 1) / chunkSize), [&](int chunk)
+    {
+        int64_t end = std::min<int64_t>(n - 1, static_cast<int64_t>(chunk + 1) * chunkSize);
+        for (int64_t i = static_cast<int64_t>(chunk) * chunkSize; i < end; i++)
+        {
+            // Direction of the range and its far end
+            int d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+            int deltaMin = delta(i, i - d);
+            int64_t lengthMax = 2;
+            while (delta(i, i + lengthMax * d) > deltaMin)
+                lengthMax *= 2;
+            int64_t length = 0;
+            for (int64_t t = lengthMax / 2; t >= 1; t /= 2)
+            {
+                if (delta(i, i + (length + t) * d) > deltaMin)
+                    length += t;
+            }
+            int64_t j = i + length * d;
+
+            // Split position: the last index sharing more than the node's prefix
+            int deltaNode = delta(i, j);
+            int64_t split = 0;
+            int64_t t = length;
+            do
+            {
+                t = (t + 1) / 2;
+                if (delta(i, i + (split + t) * d) > deltaNode)
+                    split += t;
+            } while (t > 1);
+            int64_t gamma = i + split * d + std::min(d, 0);
+
+            RadixNode& node = tree[static_cast<size_t>(i)];
+            node.first = static_cast<uint32_t>(std::min(i, j));
+            node.last = static_cast<uint32_t>(std::max(i, j));
+            node.child[0] = static_cast<uint32_t>(gamma);
+            node.childIsLeaf[0] = node.first == gamma;
+            node.child[1] = static_cast<uint32_t>(gamma + 1);
+            node.childIsLeaf[1] = node.last == gamma + 1;
+        }
+    });
+}
+
+struct LbvhContext
+{
+    const std::vector<RadixNode>& tree;
+    const std::vector<Aabb>& sortedBounds;
+    std::vector<BvhNode>& nodes;
+};
+
+// Emits the subtree covering sorted positions [first, last] depth first and
+// returns its bounds. Small or too-deep ranges collapse into one leaf.
+static Aabb emit_lbvh(LbvhContext& ctx, uint32_t radixNode, bool isLeaf, uint32_t first, uint32_t last, int depth)
+{
+    uint32_t nodeIndex = static_cast<uint32_t>(ctx.nodes.size());
+    ctx.nodes.emplace_back();
+
+    Aabb bounds;
+    uint32_t count = last - first + 1;
+    if (isLeaf || count <= lbvhLeafSize || depth >= bvhMaxDepth - 1)
+    {
+        for (uint32_t i = first; i <= last; i++)
+        {
+            bounds.grow(ctx.sortedBounds[i]);
+        }
+        ctx.nodes[nodeIndex].leftFirst = first;
+        ctx.nodes[nodeIndex].count = count;
+    }
+    else
+    {
+        const RadixNode& node = ctx.tree[radixNode];
+        for (int c = 0; c < 2; c++)
+        {
+            uint32_t childFirst = node.childIsLeaf[c] ? node.child[c] : ctx.tree[node.child[c]].first;
+            uint32_t childLast = node.childIsLeaf[c] ? node.child[c] : ctx.tree[node.child[c]].last;
+            if (c == 1)
+            {
+                ctx.nodes[nodeIndex].leftFirst = static_cast<uint32_t>(ctx.nodes.size());
+            }
+            bounds.grow(emit_lbvh(ctx, node.child[c], node.childIsLeaf[c], childFirst, childLast, depth + 1));
+        }
+        ctx.nodes[nodeIndex].count = 0;
+    }
+
+    ctx.nodes[nodeIndex].boundsMin = bounds.min;
+    ctx.nodes[nodeIndex].boundsMax = bounds.max;
+    return bounds;
+}
+
+template <typename Key>
+static void build_lbvh_with_keys(const std::vector<Aabb>& primBounds, const Aabb& centroidBounds, int keyBits, ThreadPool& pool, Bvh& bvh)
+{
+    const uint32_t n = static_cast<uint32_t>(primBounds.size());
+    Vec3 extent = centroidBounds.max - centroidBounds.min;
+    Vec3 invExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    std::vector<Key> codes(n);
+    bvh.primIndices.resize(n);
+    const int chunkSize = 4096;
+    pool.parallel_for(static_cast<int>((n + chunkSize - 1) / chunkSize), [&](int chunk)
+    {
+        uint32_t end = std::min<uint32_t>(n, (chunk + 1) * chunkSize);
+        for (uint32_t i = chunk * chunkSize; i < end; i++)
+        {
+            Vec3 centroid = (primBounds[i].min + primBounds[i].max) * 0.5f;
+            codes[i] = morton_code((centroid - centroidBounds.min) * invExtent, Key());
+            bvh.primIndices[i] = i;
+        }
+    });
+
+    radix_sort(codes, bvh.primIndices, keyBits, pool);
+
+    std::vector<Aabb> sortedBounds(n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        sortedBounds[i] = primBounds[bvh.primIndices[i]];
+    }
+
+    std::vector<RadixNode> tree;
+    build_radix_tree(codes, keyBits, tree, pool);
+
+    bvh.nodes.reserve(2 * n);
+    LbvhContext ctx = { tree, sortedBounds, bvh.nodes };
+    emit_lbvh(ctx, 0, n == 1, 0, n - 1, 0);
+}
+
+Bvh build_bvh_lbvh(const Scene& scene, ThreadPool& pool)
+{
+    uint32_t primCount = primitive_count(scene);
+    Bvh bvh;
+    if (primCount == 0)
+    {
+        return bvh;
+    }
+
+    std::vector<Aabb> primBounds(primCount);
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        primBounds[i] = primitive_bounds(scene, i);
+    }
+    Aabb centroidBounds;
+    for (const Aabb& bounds : primBounds)
+    {
+        centroidBounds.grow((bounds.min + bounds.max) * 0.5f);
+    }
+
+    if (primCount > lbvhWideKeyThreshold)
+    {
+        build_lbvh_with_keys<uint64_t>(primBounds, centroidBounds, 63, pool, bvh);
+    }
+    else
+    {
+        build_lbvh_with_keys<uint32_t>(primBounds, centroidBounds, 30, pool, bvh);
+    }
+    return bvh;
+}
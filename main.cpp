@@ -3,26 +3,39 @@
 #include <GLFW/glfw3.h>
 #include <fstream>
 #include <sstream>
-#include <ctime>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "headless.h"
+#include "cpu_tracer.h"
+#include "image.h"
+#include "frame_timer.h"
+#include "gpu_timer.h"
+#include "scene.h"
+#include "scene_buffer.h"
+#include "accumulation.h"
+#include "frame_state.h"
+#include "wavefront_buffer.h"
+#include "adaptive_buffer.h"
+#include "program_cache.h"
+#include "shader_reload.h"
+#include "resolution_controller.h"
+#include "bvh.h"
+#include "sphere_kernel.h"
 
 double mouseX, mouseY;
-const int windowWidth = 1000; const double aspect = 16.0 / 9.0;
-const int windowHeight = static_cast<int>((1 / aspect) * windowWidth);
+const int windowWidth = 1000; float aspect = defaultAspect;
+int windowHeight = static_cast<int>((1 / aspect) * windowWidth);
 double cameraX, cameraY, cameraZ;
-
-static std::string read_shader_from_source(const char* pathToFile)
-{
-    std::ifstream file_stream(pathToFile);
-    if (!file_stream.is_open())
-    {
-        std::cerr << "Could not read file from source\n";
-        return "";
-    }
-
-    std::stringstream ss;
-    ss << file_stream.rdbuf();
-    return ss.str();
-}
+std::string statsPath = "frame_stats.csv";
+std::string shaderCachePath = "shader_cache";
+// Start of the process, for time to first frame
+const std::chrono::steady_clock::time_point launchTime = std::chrono::steady_clock::now();
 
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -41,8 +54,1104 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
     }
 }
 
-int main()
+// How GPU frames are traced: a fullscreen triangle through the fragment
+// shader, the compute shader dispatched over 8x8 pixel tiles, or the
+// wavefront path tracer's kernels
+enum GpuBackend
+{
+    GpuBackendFragment,
+    GpuBackendCompute,
+    GpuBackendWavefront
+};
+
+const int computeTileSize = 8;  // local_size_x and local_size_y of the per-pixel compute kernels
+
+static bool parse_gpu_backend(const std::string& name, GpuBackend& backend)
+{
+    if (name == "fragment")
+        backend = GpuBackendFragment;
+    else if (name == "compute")
+        backend = GpuBackendCompute;
+    else if (name == "wavefront")
+        backend = GpuBackendWavefront;
+    else
+        return false;
+    return true;
+}
+
+static const char* gpu_backend_name(GpuBackend backend)
+{
+    switch (backend)
+    {
+    case GpuBackendCompute: return "compute";
+    case GpuBackendWavefront: return "wavefront";
+    default: return "fragment";
+    }
+}
+
+// Uniforms that change between the dispatches of one frame or only concern
+// one program; everything that holds for the whole frame is in FrameStateBuffer
+struct StageUniforms
+{
+    int rayQueue;
+    int bounce;
+    int shadeMaterial;
+    int adaptiveError;
+};
+
+static StageUniforms get_stage_uniforms(GLuint shaderProgram)
+{
+    StageUniforms uniforms;
+    uniforms.rayQueue = glGetUniformLocation(shaderProgram, "rayQueue");
+    uniforms.bounce = glGetUniformLocation(shaderProgram, "bounce");
+    uniforms.shadeMaterial = glGetUniformLocation(shaderProgram, "shadeMaterial");
+    uniforms.adaptiveError = glGetUniformLocation(shaderProgram, "adaptiveError");
+    return uniforms;
+}
+
+// files, variant and name are kept for ShaderReloader
+struct GpuProgram
+{
+    GLuint program;
+    StageUniforms uniforms;
+    std::vector<ShaderFile> files;
+    ShaderVariant variant;
+    const char* name;
+};
+
+static GpuProgram create_program(ProgramCache& programCache, std::vector<ShaderFile> files, const ShaderVariant& variant, const char* name)
+{
+    GpuProgram program{ 0, {}, std::move(files), variant, name };
+    program.program = programCache.create_program(read_shader_stages(program.files, variant), name);
+    program.uniforms = get_stage_uniforms(program.program);
+    return program;
+}
+
+// Kernels of the wavefront backend, in GpuPipeline::programs
+enum WavefrontStage
+{
+    WavefrontGenerate,
+    WavefrontExtend,
+    WavefrontShade,
+    WavefrontConnect,
+    WavefrontResolve,
+    WavefrontStageCount
+};
+
+const char* const wavefrontStagePaths[WavefrontStageCount] = {
+    "wavefront_generate.comp",
+    "wavefront_extend.comp",
+    "wavefront_shade.comp",
+    "wavefront_connect.comp",
+    "wavefront_resolve.comp"
+};
+
+// The programs of one backend with their uniform locations: one for the
+// fragment and compute backends, one per WavefrontStage plus the path and
+// queue storage for the wavefront backend. Adaptive sampling adds the tile
+// scheduler at scheduleProgram and its tile states. vao is only drawn by the
+// fragment backend. boundProgram saves re-binding the program a backend
+// already uses.
+struct GpuPipeline
+{
+    GpuBackend backend;
+    std::vector<GpuProgram> programs;
+    GLuint vao;
+    GLuint boundProgram = 0;
+    WavefrontBuffer wavefront;
+    FrameStateBuffer frameState;
+    float adaptiveError = 0.0f;     // 0 traces every pixel every sample
+    int scheduleProgram = -1;
+    AdaptiveTileBuffer tiles;
+};
+
+// The shaders specialized to what the scene contains and how its triangles
+// are tested; switches that don't depend on the scene are added per backend
+static ShaderVariant select_shader_variant(const Scene& scene, TriangleTest triangleTest)
+{
+    ShaderVariant variant;
+    variant.define("WATERTIGHT_TRIANGLES", triangleTest == TriangleTestWatertight);
+    variant.define("SCENE_SPHERES", !scene.spheres.empty());
+    variant.define("SCENE_TRIANGLES", !scene.triangles.empty());
+    variant.define("SCENE_INSTANCES", !scene.instances.empty());
+    return variant;
+}
+
+static GpuPipeline create_gpu_pipeline(GpuBackend backend, ProgramCache& programCache, ShaderVariant variant, float adaptiveError)
+{
+    GpuPipeline pipeline;
+    pipeline.backend = backend;
+    pipeline.adaptiveError = adaptiveError;
+    variant.define("ADAPTIVE_SAMPLING", adaptiveError > 0.0f);
+    if (backend == GpuBackendWavefront)
+    {
+        variant.define("MAX_BOUNCES", wavefrontMaxBounces);
+        for (const char* path : wavefrontStagePaths)
+        {
+            pipeline.programs.push_back(create_program(programCache, { { GL_COMPUTE_SHADER, path } }, variant, path));
+        }
+        pipeline.wavefront.init(windowWidth * windowHeight);
+    }
+    else if (backend == GpuBackendCompute)
+    {
+        pipeline.programs.push_back(create_program(programCache, { { GL_COMPUTE_SHADER, "compute_shader.comp" } }, variant, "compute program"));
+    }
+    else
+    {
+        pipeline.programs.push_back(create_program(programCache, { { GL_VERTEX_SHADER, "vertex_shader.vert" },
+                                                                   { GL_FRAGMENT_SHADER, "fragment_shader.frag" } }, variant, "shader program"));
+    }
+    if (adaptiveError > 0.0f)
+    {
+        pipeline.scheduleProgram = static_cast<int>(pipeline.programs.size());
+        pipeline.programs.push_back(create_program(programCache, { { GL_COMPUTE_SHADER, "adaptive_schedule.comp" } }, variant, "tile scheduler"));
+        pipeline.tiles.init(windowWidth, windowHeight);
+    }
+    glGenVertexArrays(1, &pipeline.vao);
+    pipeline.frameState.init();
+    std::cout << "Shader variant: " << variant.name() << "\n";
+    return pipeline;
+}
+
+static void release_gpu_pipeline(GpuPipeline& pipeline)
+{
+    glDeleteVertexArrays(1, &pipeline.vao);
+    for (const GpuProgram& program : pipeline.programs)
+    {
+        glDeleteProgram(program.program);
+    }
+    pipeline.wavefront.release();
+    pipeline.frameState.release();
+    pipeline.tiles.release();
+}
+
+static void watch_gpu_programs(const GpuPipeline& pipeline, ShaderReloader& reloader)
+{
+    for (size_t i = 0; i < pipeline.programs.size(); i++)
+    {
+        const GpuProgram& program = pipeline.programs[i];
+        reloader.watch(static_cast<int>(i), program.files, program.variant, program.name);
+    }
+}
+
+// Swaps in the programs the reloader has rebuilt since the last frame. The
+// image changes with them, so accumulation starts over.
+static void reload_gpu_programs(GpuPipeline& pipeline, ShaderReloader& reloader, AccumulationBuffer& accumulation)
+{
+    for (const ReloadedProgram& reloaded : reloader.update())
+    {
+        GpuProgram& program = pipeline.programs[reloaded.id];
+        glDeleteProgram(program.program);
+        program.program = reloaded.program;
+        program.uniforms = get_stage_uniforms(program.program);
+        pipeline.boundProgram = 0;
+        accumulation.reset();
+    }
+}
+
+static const GpuProgram& use_program(GpuPipeline& pipeline, int index)
+{
+    const GpuProgram& program = pipeline.programs[index];
+    if (pipeline.boundProgram != program.program)
+    {
+        glUseProgram(program.program);
+        pipeline.boundProgram = program.program;
+    }
+    return program;
+}
+
+static void draw_frame(GpuPipeline& pipeline, SceneBuffer& sceneBuffer)
+{
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    use_program(pipeline, 0);
+
+    sceneBuffer.bind();
+    glBindVertexArray(pipeline.vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    sceneBuffer.fence();
+}
+
+static void dispatch_pixels(int width, int height)
+{
+    glDispatchCompute((width + computeTileSize - 1) / computeTileSize, (height + computeTileSize - 1) / computeTileSize, 1);
+}
+
+// Under adaptive sampling, picks the tiles that take the next sample from the
+// current average and moments, which the accumulation targets have bound
+static void schedule_tiles(GpuPipeline& pipeline, int width, int height)
+{
+    if (pipeline.scheduleProgram < 0)
+    {
+        return;
+    }
+    pipeline.tiles.bind();
+    // The trace passes end with the barrier every next sample needs; this one
+    // only keeps the scheduler's own reads safe should that ever move
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glUniform1f(use_program(pipeline, pipeline.scheduleProgram).uniforms.adaptiveError, pipeline.adaptiveError);
+    dispatch_pixels(width, height);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+static void dispatch_frame(GpuPipeline& pipeline, SceneBuffer& sceneBuffer, int width, int height)
+{
+    use_program(pipeline, 0);
+
+    sceneBuffer.bind();
+    dispatch_pixels(width, height);
+    // The next sample reads the accumulation images back with texelFetch, and
+    // the display blits them, so imageStore must be visible to both
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    sceneBuffer.fence();
+}
+
+// Between wavefront stages: the next one reads the paths and queues the
+// last one wrote, takes its dispatch size from them, and clears some of them
+const GLbitfield wavefrontBarrier = GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT;
+
+// One path-traced sample: generate, then extend, shade per material and
+// connect for every bounce, then resolve into the accumulation image.
+// Every stage after generate is an indirect dispatch sized by its queue.
+static void trace_wavefront_frame(GpuPipeline& pipeline, SceneBuffer& sceneBuffer, int width, int height)
+{
+    WavefrontBuffer& wavefront = pipeline.wavefront;
+    sceneBuffer.bind();
+    wavefront.bind();
+
+    int rayQueue = 0;
+    wavefront.clear_queues(0, WavefrontQueueCount);
+    glUniform1i(use_program(pipeline, WavefrontGenerate).uniforms.rayQueue, rayQueue);
+    dispatch_pixels(width, height);
+    glMemoryBarrier(wavefrontBarrier);
+
+    for (int bounce = 0; bounce < wavefrontMaxBounces; bounce++)
+    {
+        wavefront.clear_queues(WavefrontQueueRays + 1 - rayQueue, 1);
+        wavefront.clear_queues(WavefrontQueueMaterials, WavefrontQueueCount - WavefrontQueueMaterials);
+
+        const StageUniforms& extendUniforms = use_program(pipeline, WavefrontExtend).uniforms;
+        glUniform1i(extendUniforms.rayQueue, rayQueue);
+        glUniform1i(extendUniforms.bounce, bounce);
+        wavefront.dispatch(WavefrontQueueRays + rayQueue);
+        glMemoryBarrier(wavefrontBarrier);
+
+        // One dispatch per material, each over only that material's hits
+        const StageUniforms& shadeUniforms = use_program(pipeline, WavefrontShade).uniforms;
+        glUniform1i(shadeUniforms.rayQueue, rayQueue);
+        glUniform1i(shadeUniforms.bounce, bounce);
+        for (int material = 0; material < WavefrontMaterialCount; material++)
+        {
+            glUniform1i(shadeUniforms.shadeMaterial, material);
+            wavefront.dispatch(WavefrontQueueMaterials + material);
+            glMemoryBarrier(wavefrontBarrier);
+        }
+
+        use_program(pipeline, WavefrontConnect);
+        wavefront.dispatch(WavefrontQueueShadow);
+        glMemoryBarrier(wavefrontBarrier);
+
+        rayQueue = 1 - rayQueue;
+    }
+
+    use_program(pipeline, WavefrontResolve);
+    dispatch_pixels(width, height);
+    // The next sample reads the color, depth and moments resolve stored with
+    // texelFetch, and the display blits them
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    sceneBuffer.fence();
+}
+
+static void print_timing(const char* label, const TimingStats& stats)
+{
+    std::cout << label << " ms:"
+              << " min " << stats.minMs << " mean " << stats.meanMs << " p50 " << stats.p50Ms
+              << " p95 " << stats.p95Ms << " p99 " << stats.p99Ms << " max " << stats.maxMs << "\n";
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Refits the BVH after the spheres and instances move and falls back to a full rebuild once
+// refits have grown its SAH cost past refitRebuildRatio times the last build's.
+struct SceneAnimation
+{
+    bool enabled = false;
+    std::vector<Sphere> restSpheres;
+    std::vector<Instance> restInstances;
+    BvhBuilder builder = BvhBuilderBinned;
+    float builtSahCost = 0.0f;
+    int refits = 0;
+    int rebuilds = 0;
+    size_t uploadedNodes = 0;
+    FrameTimer updateTimer;
+};
+
+const float refitRebuildRatio = 1.3f;
+
+// Moves the scene to time seconds and updates the top-level BVH; mesh BVHs
+// never change. With a sceneBuffer only the spheres, the instances and the
+// node ranges the refit touched are re-uploaded.
+static void update_animation(SceneAnimation& animation, float time, Scene& scene, Bvh& bvh, const std::vector<Bvh>& meshBvhs,
+                             ThreadPool& pool, SceneBuffer* sceneBuffer)
+{
+    if (!animation.enabled)
+    {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    animate_spheres(scene, animation.restSpheres, time);
+    animate_instances(scene, animation.restInstances, time);
+    std::vector<NodeRange> changed = refit_bvh(bvh, scene);
+    if (bvh_sah_cost(bvh) > animation.builtSahCost * refitRebuildRatio)
+    {
+        bvh = build_bvh(scene, animation.builder, pool);
+        animation.builtSahCost = bvh_sah_cost(bvh);
+        animation.rebuilds++;
+        if (sceneBuffer)
+        {
+            sceneBuffer->upload(scene, bvh, meshBvhs);
+            animation.uploadedNodes += bvh.nodes.size();
+        }
+    }
+    else
+    {
+        animation.refits++;
+        if (sceneBuffer)
+        {
+            sceneBuffer->write_spheres(scene.spheres.data(), 0, static_cast<int>(scene.spheres.size()));
+            sceneBuffer->write_instances(scene.instances.data(), 0, static_cast<int>(scene.instances.size()));
+            for (const NodeRange& range : changed)
+            {
+                sceneBuffer->write_nodes(&bvh.nodes[range.first], range.first, range.count);
+                animation.uploadedNodes += range.count;
+            }
+        }
+    }
+
+    animation.updateTimer.add_sample(milliseconds_since(start));
+}
+
+// Traces one more jittered sample of the current view into accumulation
+// unless the view has converged, under adaptive sampling only in the tiles
+// the scheduler picks. An animated scene restarts it every frame.
+static void accumulate_frame(GpuPipeline& pipeline, SceneBuffer& sceneBuffer, AccumulationBuffer& accumulation,
+                             const SceneAnimation& animation, GpuTimer& gpuTimer)
+{
+    accumulation.set_view(Vec3(static_cast<float>(cameraX), static_cast<float>(cameraY), static_cast<float>(cameraZ)),
+                          static_cast<float>(mouseX), static_cast<float>(mouseY));
+    if (animation.enabled)
+    {
+        accumulation.reset();
+    }
+    if (accumulation.converged())
+    {
+        return;
+    }
+    if (pipeline.scheduleProgram >= 0 && accumulation.sample_count() == 0)
+    {
+        pipeline.tiles.reset();
+    }
+
+    // Only what changed since a ring slot was last written goes into it
+    int width = accumulation.render_width();
+    int height = accumulation.render_height();
+    FrameStateBuffer& frameState = pipeline.frameState;
+    Camera camera = make_camera(Vec3(static_cast<float>(cameraX), static_cast<float>(cameraY), static_cast<float>(cameraZ)),
+                                static_cast<float>(mouseX), static_cast<float>(mouseY), windowWidth, windowHeight, aspect);
+    // The cursor moves over the window, but rays only span the traced pixels
+    camera.invWidth = 1.0f / float(width);
+    camera.invHeight = 1.0f / float(height);
+    frameState.set_camera(camera);
+    frameState.set_window(width, height);
+    frameState.set_scene(sceneBuffer.sphere_count(), sceneBuffer.triangle_count(), sceneBuffer.node_count(),
+                         sceneBuffer.triangle_test() == TriangleTestWatertight);
+    float jitterX, jitterY;
+    accumulation.next_jitter(jitterX, jitterY);
+    frameState.set_sample(accumulation.history_samples(), jitterX, jitterY);
+    frameState.set_history(accumulation.history(), accumulation.history_camera());
+    frameState.bind();
+    gpuTimer.begin();
+    if (pipeline.backend == GpuBackendCompute)
+    {
+        accumulation.bind_image_for_sample();
+        schedule_tiles(pipeline, width, height);
+        dispatch_frame(pipeline, sceneBuffer, width, height);
+    }
+    else if (pipeline.backend == GpuBackendWavefront)
+    {
+        accumulation.bind_image_for_sample();
+        schedule_tiles(pipeline, width, height);
+        trace_wavefront_frame(pipeline, sceneBuffer, width, height);
+    }
+    else
+    {
+        accumulation.bind_for_sample();
+        schedule_tiles(pipeline, width, height);
+        draw_frame(pipeline, sceneBuffer);
+    }
+    gpuTimer.end();
+    frameState.fence();
+    accumulation.finish_sample(camera);
+}
+
+// Feeds the newest trace time to the controller and traces at its scale
+static void update_resolution(ResolutionController& resolution, int collected, const FrameTimer& gpuTraceTimer, AccumulationBuffer& accumulation)
+{
+    if (collected > 0 && resolution.add_sample(gpuTraceTimer.latest()))
+    {
+        accumulation.set_render_size(static_cast<int>(std::lround(windowWidth * resolution.scale())),
+                                     static_cast<int>(std::lround(windowHeight * resolution.scale())));
+    }
+}
+
+static void print_resolution(const ResolutionController& resolution, const AccumulationBuffer& accumulation)
+{
+    if (!resolution.enabled())
+    {
+        return;
+    }
+    std::cout << "Dynamic resolution: scale " << resolution.scale() << " (" << accumulation.render_width() << "x" << accumulation.render_height()
+              << "), mean " << resolution.mean_scale() << ", range " << resolution.min_scale_used() << " to " << resolution.max_scale_used()
+              << ", " << resolution.changes() << " changes\n";
+}
+
+// Samples traced since the view changed against uniform sampling, which has
+// to give every tile what the noisiest one took to reach the same error
+static void print_adaptive(const AdaptiveStats& stats)
+{
+    double saved = stats.uniformSamples > 0 ? 100.0 * (1.0 - double(stats.tracedSamples) / double(stats.uniformSamples)) : 0.0;
+    std::cout << "Adaptive sampling: " << stats.tracedSamples << " samples traced, " << stats.uniformSamples
+              << " uniformly for the same error bound (" << saved << "% saved), " << stats.activeTiles << " of "
+              << stats.tileCount << " tiles still sampling\n";
+}
+
+static void print_frame_state(const FrameStateBuffer& frameState)
+{
+    std::cout << "Frame state: " << frameState.slot_writes() << " slot writes, " << frameState.slot_reuses()
+              << " reuses, " << frameState.bytes_written() << " bytes written\n";
+}
+
+static void print_animation(const SceneAnimation& animation, const Bvh& bvh)
+{
+    if (!animation.enabled)
+    {
+        return;
+    }
+    int updates = std::max(1, animation.refits + animation.rebuilds);
+    std::cout << "Animation: " << animation.refits << " refits, " << animation.rebuilds << " rebuilds, "
+              << animation.uploadedNodes / updates << " of " << bvh.nodes.size() << " nodes uploaded per frame\n";
+    print_timing("scene update", animation.updateTimer.stats());
+}
+
+// Launch to the first finished frame, and how much of it went into programs
+static void print_first_frame(const ProgramCache& programCache)
+{
+    std::cout << "Time to first frame: " << milliseconds_since(launchTime) << " ms, programs ready in " << programCache.milliseconds()
+              << " ms (" << programCache.cache_hits() << " from cache, " << programCache.compiles() << " compiled)\n";
+}
+
+// Creates the directory frames are written to, if there is one
+static bool create_output_directory(const std::string& outputDir)
+{
+    std::error_code error;
+    if (!outputDir.empty() && !std::filesystem::is_directory(outputDir, error)
+        && !std::filesystem::create_directories(outputDir, error))
+    {
+        std::cerr << "Could not create " << outputDir << ": " << error.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Renders frameCount frames into an offscreen FBO and writes them to outputDir.
+// An empty outputDir only renders, which is what throughput runs want.
+static int run_headless(int frameCount, const std::string& outputDir, Scene& scene, Bvh& bvh, const std::vector<Bvh>& meshBvhs,
+                        TriangleTest triangleTest, int maxSamples, bool temporal, float adaptiveError, GpuBackend backend,
+                        SceneAnimation& animation, ResolutionController& resolution, ThreadPool& pool)
+{
+    if (!headless_init(windowWidth, windowHeight) || !create_output_directory(outputDir))
+    {
+        headless_shutdown();
+        return -1;
+    }
+
+    // Centered cursor: yaw and pitch of zero, looking down -Z at the scene
+    mouseX = windowWidth * 0.5;
+    mouseY = windowHeight * 0.5;
+
+    ProgramCache programCache;
+    programCache.init(shaderCachePath);
+    GpuPipeline pipeline = create_gpu_pipeline(backend, programCache, select_shader_variant(scene, triangleTest), adaptiveError);
+    SceneBuffer sceneBuffer;
+    sceneBuffer.init(triangleTest);
+    sceneBuffer.upload(scene, bvh, meshBvhs);
+    AccumulationBuffer accumulation;
+    accumulation.init(windowWidth, windowHeight, maxSamples, temporal, adaptiveError > 0.0f);
+
+    GpuTimer gpuTimer;
+    gpuTimer.init();
+    FrameTimer frameTimer;
+    FrameTimer gpuTraceTimer;
+    auto release = [&]()
+    {
+        gpuTimer.release();
+        accumulation.release();
+        sceneBuffer.release();
+        release_gpu_pipeline(pipeline);
+        headless_shutdown();
+    };
+    auto startTime = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        frameTimer.begin_frame();
+        update_resolution(resolution, gpuTimer.collect(gpuTraceTimer), gpuTraceTimer, accumulation);
+        update_animation(animation, frame / 60.0f, scene, bvh, meshBvhs, pool, &sceneBuffer);
+        accumulate_frame(pipeline, sceneBuffer, accumulation, animation, gpuTimer);
+        headless_bind_target();
+        accumulation.present();
+        if (frame == 0)
+        {
+            glFinish();
+            print_first_frame(programCache);
+        }
+
+        if (!outputDir.empty())
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%04d.ppm", frame);
+            if (!headless_save_frame((std::filesystem::path(outputDir) / name).string()))
+            {
+                release();
+                return -1;
+            }
+        }
+    }
+    glFinish();
+    frameTimer.begin_frame();
+    gpuTimer.drain(gpuTraceTimer);
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Rendered " << frameCount << " frames in " << elapsedMs << " ms with the " << gpu_backend_name(backend)
+              << " backend, " << accumulation.sample_count() << " samples accumulated\n";
+    print_timing("frame", frameTimer.stats());
+    print_timing("gpu trace", gpuTraceTimer.stats());
+    print_resolution(resolution, accumulation);
+    if (pipeline.scheduleProgram >= 0)
+    {
+        print_adaptive(pipeline.tiles.read_stats(accumulation.render_width(), accumulation.render_height()));
+    }
+    print_frame_state(pipeline.frameState);
+    print_animation(animation, bvh);
+    write_timing_csv(statsPath, { { "frame", frameTimer.stats() }, { "gpu_trace", gpuTraceTimer.stats() },
+                                  { "scene_update", animation.updateTimer.stats() } });
+
+    release();
+    return 0;
+}
+
+// Headless camera defaults for the CPU tracer
+static CpuFrameParams default_cpu_frame_params()
+{
+    CpuFrameParams params;
+    params.width = windowWidth;
+    params.height = windowHeight;
+    params.mouseX = static_cast<float>(windowWidth * 0.5);
+    params.mouseY = static_cast<float>(windowHeight * 0.5);
+    params.cameraPos = Vec3(static_cast<float>(cameraX), static_cast<float>(cameraY), static_cast<float>(cameraZ));
+    params.aspect = aspect;
+    return params;
+}
+
+// Renders frameCount frames with the CPU reference tracer on one thread per core
+// and reports throughput. Same camera defaults and output layout as run_headless.
+static int run_cpu(int frameCount, const std::string& outputDir, Scene& scene, Bvh& bvh, const std::vector<Bvh>& meshBvhs,
+                   int bvhWidth, int packetSize, TriangleTest triangleTest, bool wavefront, float adaptiveError, SceneAnimation& animation,
+                   ThreadPool& pool)
+{
+    if (!create_output_directory(outputDir))
+    {
+        return -1;
+    }
+
+    CpuFrameParams params = default_cpu_frame_params();
+    params.packetSize = packetSize;
+    params.adaptiveError = adaptiveError;
+    CpuSceneBvh cpuBvh;
+    cpuBvh.width = bvhWidth;
+    cpuBvh.triangleTest = triangleTest;
+    update_cpu_scene_bvh(cpuBvh, scene, bvh, meshBvhs, true);
+
+    std::vector<unsigned char> rgb;
+    FrameTimer frameTimer;
+    double totalMs = 0.0;
+    long long totalRays = 0;
+    CpuWavefront pathTracer;
+    WavefrontStats wavefrontTotals = {};
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        update_animation(animation, frame / 60.0f, scene, bvh, meshBvhs, pool, nullptr);
+        if (animation.enabled)
+        {
+            update_cpu_scene_bvh(cpuBvh, scene, bvh, meshBvhs, false);
+            pathTracer.reset();
+        }
+        CpuRenderStats stats;
+        if (wavefront)
+        {
+            // Every frame is one more sample of the path-traced average
+            WavefrontStats sample = pathTracer.render_sample(params, scene, cpuBvh, pool);
+            pathTracer.resolve(rgb);
+            stats.milliseconds = sample.milliseconds;
+            stats.rays = sample.extensionRays + sample.shadowRays;
+            wavefrontTotals.extensionRays += sample.extensionRays;
+            wavefrontTotals.shadowRays += sample.shadowRays;
+            for (int material = 0; material < WavefrontMaterialCount; material++)
+            {
+                wavefrontTotals.shaded[material] += sample.shaded[material];
+            }
+        }
+        else
+        {
+            stats = cpu_render_frame(params, scene, cpuBvh, pool, rgb);
+        }
+        frameTimer.add_sample(stats.milliseconds);
+        totalMs += stats.milliseconds;
+        totalRays += stats.rays;
+
+        if (!outputDir.empty())
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%04d.ppm", frame);
+            if (!write_ppm((std::filesystem::path(outputDir) / name).string(), params.width, params.height, rgb))
+            {
+                return -1;
+            }
+        }
+    }
+
+    double raysPerSecond = totalRays / (totalMs / 1000.0);
+    std::cout << "CPU rendered " << frameCount << " frames in " << totalMs << " ms ("
+              << totalMs / frameCount << " ms/frame) on " << pool.size() << " threads, BVH width " << bvhWidth
+              << (packetSize ? ", " + std::to_string(packetSize) + "-ray packets" : "") << ", " << sphere_kernel_name(cpuBvh.sphereKernel)
+              << " sphere kernel, " << triangle_test_name(triangleTest) << " triangles\n"
+              << raysPerSecond / 1e6 << " Mrays/s, " << raysPerSecond / pool.size() / 1e6 << " Mrays/s per core\n";
+    if (wavefront)
+    {
+        std::cout << "Wavefront path tracing, " << pathTracer.sample_count() << " samples accumulated: "
+                  << wavefrontTotals.extensionRays << " extension rays, " << wavefrontTotals.shadowRays << " shadow rays, "
+                  << wavefrontTotals.shaded[WavefrontMaterialDiffuse] << " diffuse and "
+                  << wavefrontTotals.shaded[WavefrontMaterialMirror] << " mirror hits shaded\n";
+        if (adaptiveError > 0.0f)
+        {
+            print_adaptive(pathTracer.adaptive_stats());
+        }
+    }
+    print_timing("frame", frameTimer.stats());
+    print_animation(animation, bvh);
+    write_timing_csv(statsPath, { { "frame", frameTimer.stats() }, { "scene_update", animation.updateTimer.stats() } });
+    return 0;
+}
+
+// Build time against triangle count for each BVH builder on random triangle soups.
+// The full-sweep builder is skipped where it would take minutes.
+static int run_bvh_benchmark(ThreadPool& pool)
+{
+    std::cout << "triangles,builder,threads,build_ms,nodes,sah_cost\n";
+    for (int triangleCount : { 10000, 100000, 1000000 })
+    {
+        Scene scene = make_random_scene(0, triangleCount, 0, 7);
+
+        for (BvhBuilder builder : { BvhBuilderSweep, BvhBuilderBinned, BvhBuilderLbvh })
+        {
+            if (builder == BvhBuilderSweep && triangleCount > 100000)
+            {
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            Bvh bvh = build_bvh(scene, builder, pool);
+            double ms = milliseconds_since(start);
+            unsigned threads = builder == BvhBuilderSweep ? 1 : pool.size();
+            std::cout << triangleCount << "," << bvh_builder_name(builder) << "," << threads << "," << ms << ","
+                      << bvh.nodes.size() << "," << bvh_sah_cost(bvh) << "\n";
+        }
+    }
+    return 0;
+}
+
+// Primary-ray throughput of the CPU tracer on the loaded scene for each BVH
+// width and packet size, so they can be compared with binary single-ray
+// traversal on identical rays.
+static int run_traversal_benchmark(int frameCount, const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs, ThreadPool& pool)
 {
+    struct Mode
+    {
+        int width;
+        int packetSize;
+    };
+    CpuFrameParams params = default_cpu_frame_params();
+    std::vector<unsigned char> rgb;
+    std::vector<unsigned char> binaryImage;
+    double binaryRaysPerSecond = 0.0;
+    std::cout << "bvh_width,packet_size,threads,frames,ms_per_frame,mrays_per_s,speedup,pixels_differing\n";
+    for (Mode mode : { Mode{ 2, 0 }, Mode{ 4, 0 }, Mode{ 8, 0 }, Mode{ 2, 8 }, Mode{ 2, 16 } })
+    {
+        CpuSceneBvh cpuBvh;
+        cpuBvh.width = mode.width;
+        update_cpu_scene_bvh(cpuBvh, scene, bvh, meshBvhs, true);
+        params.packetSize = mode.packetSize;
+
+        double totalMs = 0.0;
+        long long totalRays = 0;
+        for (int frame = 0; frame < frameCount; frame++)
+        {
+            CpuRenderStats stats = cpu_render_frame(params, scene, cpuBvh, pool, rgb);
+            totalMs += stats.milliseconds;
+            totalRays += stats.rays;
+        }
+        double raysPerSecond = totalRays / (totalMs / 1000.0);
+        if (binaryImage.empty())
+        {
+            binaryRaysPerSecond = raysPerSecond;
+            binaryImage = rgb;
+        }
+        // Rounding differs slightly between SIMD and scalar intersection, flipping the odd edge pixel
+        int pixelsDiffering = 0;
+        for (size_t i = 0; i < rgb.size(); i += 3)
+        {
+            pixelsDiffering += rgb[i] != binaryImage[i];
+        }
+        std::cout << mode.width << "," << mode.packetSize << "," << pool.size() << "," << frameCount << "," << totalMs / frameCount << ","
+                  << raysPerSecond / 1e6 << "," << raysPerSecond / binaryRaysPerSecond << "," << pixelsDiffering << "\n";
+    }
+    return 0;
+}
+
+// Sphere tests per second for each batch kernel this CPU supports, on random
+// spheres and unit rays from inside the scene, tested in leaf-sized and large
+// batches. Mismatches count batches where a kernel picks a different sphere
+// than the scalar one; FMA rounding flips the odd grazing hit.
+static int run_sphere_benchmark()
+{
+    const int sphereCount = 1 << 16;
+    const int rayCount = 4096;
+    Scene scene = make_random_scene(sphereCount, 0, 0, 7);
+    std::vector<uint32_t> order(sphereCount);
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    SphereSoA soa;
+    build_sphere_soa(scene, order, soa);
+
+    std::mt19937 rng(11);
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    std::vector<Vec3> directions(rayCount);
+    for (Vec3& rd : directions)
+    {
+        rd = normalize(Vec3(gaussian(rng), gaussian(rng), gaussian(rng)));
+    }
+    const Vec3 ro(0.0f, 1.0f, 0.0f);
+
+    std::cout << "kernel,batch,spheres,rays,ms,mtests_per_s,speedup,mismatches\n";
+    for (uint32_t batch : { 16u, 1024u })
+    {
+        std::vector<int> scalarNearest;
+        double scalarTestsPerSecond = 0.0;
+        for (SphereKernel kernel : { SphereKernelScalar, SphereKernelAvx2, SphereKernelAvx512 })
+        {
+            if (!sphere_kernel_supported(kernel))
+            {
+                continue;
+            }
+            NearestSphereFn nearestSphere = nearest_sphere_function(kernel);
+            std::vector<int> nearest;
+            nearest.reserve(static_cast<size_t>(rayCount) * (sphereCount / batch));
+            auto start = std::chrono::steady_clock::now();
+            for (const Vec3& rd : directions)
+            {
+                for (uint32_t first = 0; first < sphereCount; first += batch)
+                {
+                    float tHit = 1e30f;
+                    nearest.push_back(nearestSphere(soa, first, batch, ro, rd, tHit));
+                }
+            }
+            double ms = milliseconds_since(start);
+            double testsPerSecond = static_cast<double>(rayCount) * sphereCount / (ms / 1000.0);
+            if (scalarNearest.empty())
+            {
+                scalarNearest = nearest;
+                scalarTestsPerSecond = testsPerSecond;
+            }
+            size_t mismatches = 0;
+            for (size_t i = 0; i < nearest.size(); i++)
+            {
+                mismatches += nearest[i] != scalarNearest[i];
+            }
+            std::cout << sphere_kernel_name(kernel) << "," << batch << "," << sphereCount << "," << rayCount << "," << ms << ","
+                      << testsPerSecond / 1e6 << "," << testsPerSecond / scalarTestsPerSecond << "," << mismatches << "\n";
+        }
+    }
+    return 0;
+}
+
+// "16:9" or "1.6"
+static bool parse_aspect(const std::string& text, float& result)
+{
+    size_t colon = text.find(':');
+    float value = colon == std::string::npos ? std::strtof(text.c_str(), nullptr)
+                                             : std::strtof(text.substr(0, colon).c_str(), nullptr) / std::strtof(text.substr(colon + 1).c_str(), nullptr);
+    if (!(value > 0.0f) || value > 1000.0f)
+        return false;
+    result = value;
+    return true;
+}
+
+static void print_usage(const char* program)
+{
+    std::cout << "Usage: " << program << " [--headless | --cpu | --bench-bvh | --bench-traversal | --bench-spheres] [--frames N] [--output DIR] [--stats FILE]\n"
+              << "       [--scene FILE | --random-spheres N --random-triangles N --random-instances N] [--bvh BUILDER] [--bvh-width N]\n"
+              << "       [--packets N] [--watertight] [--max-samples N] [--aspect W:H] [--backend NAME] [--animate]\n"
+              << "       [--shader-cache DIR] [--frame-budget MS] [--min-scale S] [--no-temporal] [--adaptive ERROR]\n"
+              << "  --headless    render offscreen through EGL, no window\n"
+              << "  --cpu         render with the multithreaded CPU reference tracer\n"
+              << "  --bench-bvh   report BVH build time against triangle count and exit\n"
+              << "  --bench-traversal  compare CPU rays/s for BVH widths 2, 4 and 8 on the scene over --frames frames\n"
+              << "  --bench-spheres    compare the scalar, AVX2 and AVX-512 sphere batch kernels and exit\n"
+              << "  --frames N    number of frames to render in headless or CPU mode (default 1)\n"
+              << "  --output DIR  directory for headless or CPU PPM frames, empty to skip writing (default frames)\n"
+              << "  --stats FILE  CSV file for frame time statistics written on exit (default frame_stats.csv)\n"
+              << "  --shader-cache DIR  directory of linked program binaries reused across launches, empty to always compile\n"
+              << "                (default shader_cache)\n"
+              << "  --scene FILE  load spheres and triangles from a scene or OBJ file\n"
+              << "  --random-spheres N, --random-triangles N, --random-instances N  generate a random scene for load tests\n"
+              << "  --bvh BUILDER binned (default), lbvh for fast rebuilds, or sweep for the slow full SAH\n"
+              << "  --bvh-width N CPU tracer traverses the binary BVH (2, default) or a collapsed 4- or 8-wide one\n"
+              << "  --packets N   CPU tracer traces primary rays in packets of 8 or 16 (default off)\n"
+              << "  --watertight  use the watertight triangle test on both backends, so no ray slips between adjacent triangles\n"
+              << "  --max-samples N  jittered samples averaged while the view stays still before it counts as converged (default 64)\n"
+              << "  --aspect W:H  image aspect ratio, as W:H or a single number; the window is 1000 pixels wide (default 16:9)\n"
+              << "  --backend NAME  trace GPU frames with the fragment shader (default), the compute shader over 8x8 tiles,\n"
+              << "                or wavefront path tracing in separate generate/extend/shade/connect kernels;\n"
+              << "                with --cpu, wavefront runs the CPU mirror of the path tracer\n"
+              << "  --frame-budget MS  scale the traced resolution each frame to keep the GPU trace near MS, e.g. 16.6,\n"
+              << "                and upscale it to the window (default 0, always full resolution)\n"
+              << "  --min-scale S lowest resolution scale --frame-budget may pick (default 0.25)\n"
+              << "  --no-temporal start accumulation over whenever the camera moves instead of reprojecting it\n"
+              << "  --adaptive ERROR  sample only the 8x8 tiles whose relative standard error is above ERROR, e.g. 0.01,\n"
+              << "                and stop the rest until the view changes; GPU backends and the CPU path tracer\n"
+              << "                (default 0, every pixel every sample)\n"
+              << "  --animate     move spheres and instances every frame, refitting the BVH and rebuilding when it degrades\n";
+}
+
+int main(int argc, char** argv)
+{
+    bool headless = false;
+    bool cpu = false;
+    bool benchBvh = false;
+    bool benchTraversal = false;
+    bool benchSpheres = false;
+    int bvhWidth = 2;
+    int packetSize = 0;
+    int batchFrames = 1;
+    std::string outputDir = "frames";
+    std::string scenePath;
+    int randomSpheres = 0;
+    int randomTriangles = 0;
+    int randomInstances = 0;
+    BvhBuilder bvhBuilder = BvhBuilderBinned;
+    bool animate = false;
+    TriangleTest triangleTest = TriangleTestMollerTrumbore;
+    int maxSamples = 64;
+    GpuBackend gpuBackend = GpuBackendFragment;
+    double frameBudgetMs = 0.0;
+    float minRenderScale = 0.25f;
+    bool temporal = true;
+    float adaptiveError = 0.0f;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--headless")
+        {
+            headless = true;
+        }
+        else if (arg == "--cpu")
+        {
+            cpu = true;
+        }
+        else if (arg == "--animate")
+        {
+            animate = true;
+        }
+        else if (arg == "--no-temporal")
+        {
+            temporal = false;
+        }
+        else if (arg == "--watertight")
+        {
+            triangleTest = TriangleTestWatertight;
+        }
+        else if (arg == "--bench-bvh")
+        {
+            benchBvh = true;
+        }
+        else if (arg == "--bench-traversal")
+        {
+            benchTraversal = true;
+        }
+        else if (arg == "--bench-spheres")
+        {
+            benchSpheres = true;
+        }
+        else if (arg == "--bvh-width" && i + 1 < argc && (std::atoi(argv[i + 1]) == 2 || std::atoi(argv[i + 1]) == 4 || std::atoi(argv[i + 1]) == 8))
+        {
+            bvhWidth = std::atoi(argv[++i]);
+        }
+        else if (arg == "--packets" && i + 1 < argc && (std::atoi(argv[i + 1]) == 8 || std::atoi(argv[i + 1]) == 16))
+        {
+            packetSize = std::atoi(argv[++i]);
+        }
+        else if (arg == "--aspect" && i + 1 < argc && parse_aspect(argv[i + 1], aspect))
+        {
+            i++;
+            windowHeight = std::max(1, static_cast<int>((1 / aspect) * windowWidth));
+        }
+        else if (arg == "--max-samples" && i + 1 < argc)
+        {
+            maxSamples = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--backend" && i + 1 < argc && parse_gpu_backend(argv[i + 1], gpuBackend))
+        {
+            i++;
+        }
+        else if (arg == "--frame-budget" && i + 1 < argc)
+        {
+            frameBudgetMs = std::max(0.0, std::atof(argv[++i]));
+        }
+        else if (arg == "--adaptive" && i + 1 < argc)
+        {
+            adaptiveError = std::max(0.0f, static_cast<float>(std::atof(argv[++i])));
+        }
+        else if (arg == "--min-scale" && i + 1 < argc)
+        {
+            minRenderScale = static_cast<float>(std::atof(argv[++i]));
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            batchFrames = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--output" && i + 1 < argc)
+        {
+            outputDir = argv[++i];
+        }
+        else if (arg == "--stats" && i + 1 < argc)
+        {
+            statsPath = argv[++i];
+        }
+        else if (arg == "--shader-cache" && i + 1 < argc)
+        {
+            shaderCachePath = argv[++i];
+        }
+        else if (arg == "--scene" && i + 1 < argc)
+        {
+            scenePath = argv[++i];
+        }
+        else if (arg == "--random-spheres" && i + 1 < argc)
+        {
+            randomSpheres = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--bvh" && i + 1 < argc && parse_bvh_builder(argv[i + 1], bvhBuilder))
+        {
+            i++;
+        }
+        else if (arg == "--random-triangles" && i + 1 < argc)
+        {
+            randomTriangles = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--random-instances" && i + 1 < argc)
+        {
+            randomInstances = std::max(0, std::atoi(argv[++i]));
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return arg == "--help" ? 0 : -1;
+        }
+    }
+
+    ThreadPool pool;
+    if (benchBvh)
+    {
+        return run_bvh_benchmark(pool);
+    }
+    if (benchSpheres)
+    {
+        return run_sphere_benchmark();
+    }
+
+    Scene scene;
+    if (!scenePath.empty())
+    {
+        if (!load_scene(scenePath, scene))
+        {
+            return -1;
+        }
+    }
+    else if (randomSpheres > 0 || randomTriangles > 0 || randomInstances > 0)
+    {
+        scene = make_random_scene(randomSpheres, randomTriangles, randomInstances, 1);
+    }
+    else
+    {
+        scene = make_default_scene();
+    }
+    size_t meshTriangles = 0;
+    for (const Mesh& mesh : scene.meshes)
+    {
+        meshTriangles += mesh.triangles.size();
+    }
+    std::cout << "Scene: " << scene.spheres.size() << " spheres, " << scene.triangles.size() << " triangles, "
+              << scene.instances.size() << " instances of " << scene.meshes.size() << " meshes (" << meshTriangles << " triangles)\n";
+
+    auto buildStart = std::chrono::steady_clock::now();
+    std::vector<Bvh> meshBvhs = build_mesh_bvhs(scene, bvhBuilder, pool);
+    if (!meshBvhs.empty())
+    {
+        std::cout << "Mesh BVHs built in " << milliseconds_since(buildStart) << " ms\n";
+        buildStart = std::chrono::steady_clock::now();
+    }
+    Bvh bvh = build_bvh(scene, bvhBuilder, pool);
+    std::cout << "BVH (" << bvh_builder_name(bvhBuilder) << "): " << bvh.nodes.size() << " nodes, SAH cost " << bvh_sah_cost(bvh)
+              << ", built in " << milliseconds_since(buildStart) << " ms on " << pool.size() << " threads\n";
+
+    ResolutionController resolution;
+    resolution.init(frameBudgetMs, minRenderScale);
+
+    SceneAnimation animation;
+    animation.enabled = animate;
+    animation.restSpheres = scene.spheres;
+    animation.restInstances = scene.instances;
+    animation.builder = bvhBuilder;
+    animation.builtSahCost = bvh_sah_cost(bvh);
+
+    if (benchTraversal)
+    {
+        return run_traversal_benchmark(batchFrames, scene, bvh, meshBvhs, pool);
+    }
+    if (headless)
+    {
+        return run_headless(batchFrames, outputDir, scene, bvh, meshBvhs, triangleTest, maxSamples, temporal, adaptiveError, gpuBackend, animation,
+                            resolution, pool);
+    }
+    if (cpu)
+    {
+        return run_cpu(batchFrames, outputDir, scene, bvh, meshBvhs, bvhWidth, packetSize, triangleTest, gpuBackend == GpuBackendWavefront,
+                       adaptiveError, animation, pool);
+    }
+
     if (!glfwInit())
     {
         std::cout << "Failed to initialize GLFW\n";
@@ -75,82 +1184,57 @@ int main()
 
     glViewport(0, 0, windowWidth, windowHeight);
 
-    std::string stringVertexSource = read_shader_from_source("vertex_shader.vert");
-    const char* vertexShaderSource = stringVertexSource.c_str();
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-    glCompileShader(vertexShader);
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
-        std::cerr << "Vertex shader compilation failed:\n" << infoLog << std::endl;
-    }
-
-
-    std::string stringFragmentSource = read_shader_from_source("fragment_shader.frag");
-    const char* fragmentShaderSource = stringFragmentSource.c_str();
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-    glCompileShader(fragmentShader);
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
-        std::cerr << "Fragment shader compilation failed:\n" << infoLog << std::endl;
-    }
-
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success)
+    ProgramCache programCache;
+    programCache.init(shaderCachePath);
+    GpuPipeline pipeline = create_gpu_pipeline(gpuBackend, programCache, select_shader_variant(scene, triangleTest), adaptiveError);
+    ShaderReloader reloader;
+    if (reloader.init(window))
     {
-        glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
-        std::cerr << "Shader program linking failed:\n" << infoLog << std::endl;
+        watch_gpu_programs(pipeline, reloader);
     }
+    SceneBuffer sceneBuffer;
+    sceneBuffer.init(triangleTest);
+    sceneBuffer.upload(scene, bvh, meshBvhs);
+    AccumulationBuffer accumulation;
+    accumulation.init(windowWidth, windowHeight, maxSamples, temporal, adaptiveError > 0.0f);
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    clock_t startTime = clock();
-    int frameCount = 0;
-    double fps = 0.0;
-    int mousePosUniformLoc = glGetUniformLocation(shaderProgram, "mousePos");
-    int windowWidthUniformLoc = glGetUniformLocation(shaderProgram, "windowWidth");
-    int windowHeightUniformLoc = glGetUniformLocation(shaderProgram, "windowHeight");
-    int cameraPosUniformLoc = glGetUniformLocation(shaderProgram, "cameraPos");
+    GpuTimer gpuTimer;
+    gpuTimer.init();
+    FrameTimer frameTimer;
+    FrameTimer gpuTraceTimer;
+    auto lastReport = std::chrono::steady_clock::now();
+    bool firstFramePrinted = false;
     while (!glfwWindowShouldClose(window))
     {
-        frameCount++;
-        clock_t currentTime = clock();
-        if (currentTime - startTime >= CLOCKS_PER_SEC)
+        frameTimer.begin_frame();
+        update_resolution(resolution, gpuTimer.collect(gpuTraceTimer), gpuTraceTimer, accumulation);
+        update_animation(animation, static_cast<float>(glfwGetTime()), scene, bvh, meshBvhs, pool, &sceneBuffer);
+        reload_gpu_programs(pipeline, reloader, accumulation);
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1))
         {
-            fps = frameCount;
-            frameCount = 0;
-            startTime = currentTime;
-            std::cout << fps << "\n";
+            print_timing("frame", frameTimer.stats());
+            print_timing("gpu trace", gpuTraceTimer.stats());
+            std::cout << "samples " << accumulation.sample_count() << (accumulation.converged() ? " (converged)" : "") << "\n";
+            print_resolution(resolution, accumulation);
+            if (pipeline.scheduleProgram >= 0)
+            {
+                // Once a second, so the wait for the read-back doesn't matter
+                print_adaptive(pipeline.tiles.read_stats(accumulation.render_width(), accumulation.render_height()));
+            }
+            lastReport = now;
         }
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glUseProgram(shaderProgram);
-
-        glUniform2f(mousePosUniformLoc, mouseX, mouseY);
-        glUniform1i(windowWidthUniformLoc, windowWidth);
-        glUniform1i(windowHeightUniformLoc, windowHeight);
-        glUniform3f(cameraPosUniformLoc, cameraX, cameraY, cameraZ);
-            
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
+        accumulate_frame(pipeline, sceneBuffer, accumulation, animation, gpuTimer);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        accumulation.present();
 
         glfwSwapBuffers(window);
+        if (!firstFramePrinted)
+        {
+            glFinish();
+            print_first_frame(programCache);
+            firstFramePrinted = true;
+        }
         glfwPollEvents();
 
         if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
@@ -173,8 +1257,18 @@ int main()
         }
     }
 
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shaderProgram);
+    gpuTimer.drain(gpuTraceTimer);
+    print_resolution(resolution, accumulation);
+    print_frame_state(pipeline.frameState);
+    print_animation(animation, bvh);
+    write_timing_csv(statsPath, { { "frame", frameTimer.stats() }, { "gpu_trace", gpuTraceTimer.stats() },
+                                  { "scene_update", animation.updateTimer.stats() } });
+
+    gpuTimer.release();
+    accumulation.release();
+    sceneBuffer.release();
+    reloader.release();
+    release_gpu_pipeline(pipeline);
 
     glfwTerminate();
     return 0;
@@ -0,0 +1,189 @@
+#include "mbvh.h"
+
+#include "cpu_features.h"
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+// SSE2 is part of x86-64 and needs no runtime check
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MBVH_SSE 1
+#endif
+
+static float node_area(const BvhNode& node)
+{
+    Aabb bounds;
+    bounds.min = node.boundsMin;
+    bounds.max = node.boundsMax;
+    return bounds.area();
+}
+
+template <int Width>
+static uint32_t collapse_node(const Bvh& bvh, uint32_t binaryNode, Mbvh<Width>& mbvh)
+{
+    uint32_t nodeIndex = static_cast<uint32_t>(mbvh.nodes.size());
+    mbvh.nodes.emplace_back();
+
+    uint32_t children[Width];
+    int childCount = 0;
+    if (bvh.nodes[binaryNode].is_leaf())
+    {
+        children[childCount++] = binaryNode;
+    }
+    else
+    {
+        children[childCount++] = binaryNode + 1;
+        children[childCount++] = bvh.nodes[binaryNode].leftFirst;
+    }
+
+    // Open the largest interior child until the node is full
+    while (childCount < Width)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < childCount; i++)
+        {
+            const BvhNode& child = bvh.nodes[children[i]];
+            if (!child.is_leaf() && node_area(child) > largestArea)
+            {
+                largest = i;
+                largestArea = node_area(child);
+            }
+        }
+        if (largest < 0)
+            break;
+        uint32_t opened = children[largest];
+        children[largest] = opened + 1;
+        children[childCount++] = bvh.nodes[opened].leftFirst;
+    }
+
+    MbvhNode<Width> node = {};
+    node.childCount = childCount;
+    for (int i = 0; i < Width; i++)
+    {
+        // Unused slots are never tested; childCount masks them off
+        node.child[i] = UINT32_MAX;
+        node.minX[i] = node.minY[i] = node.minZ[i] = 1e30f;
+        node.maxX[i] = node.maxY[i] = node.maxZ[i] = -1e30f;
+    }
+    for (int i = 0; i < childCount; i++)
+    {
+        const BvhNode& child = bvh.nodes[children[i]];
+        node.minX[i] = child.boundsMin.x;
+        node.minY[i] = child.boundsMin.y;
+        node.minZ[i] = child.boundsMin.z;
+        node.maxX[i] = child.boundsMax.x;
+        node.maxY[i] = child.boundsMax.y;
+        node.maxZ[i] = child.boundsMax.z;
+        if (child.is_leaf())
+        {
+            node.child[i] = child.leftFirst;
+            node.count[i] = child.count;
+        }
+        else
+        {
+            node.child[i] = collapse_node(bvh, children[i], mbvh);
+            node.count[i] = 0;
+        }
+    }
+    mbvh.nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+template <int Width>
+Mbvh<Width> collapse_bvh(const Bvh& bvh)
+{
+    Mbvh<Width> mbvh;
+    if (bvh.nodes.empty())
+    {
+        return mbvh;
+    }
+    mbvh.nodes.reserve(bvh.nodes.size() / (Width - 1) + 1);
+    collapse_node(bvh, 0, mbvh);
+    mbvh.primIndices = bvh.primIndices;
+    return mbvh;
+}
+
+// Portable reference for the SIMD versions below
+template <int Width>
+static unsigned intersect_children_scalar(const MbvhNode<Width>& node, const Vec3& ro, const Vec3& invDir, float tHit, float (&tEnter)[Width])
+{
+    unsigned mask = 0;
+    for (int i = 0; i < Width; i++)
+    {
+        float tx0 = (node.minX[i] - ro.x) * invDir.x, tx1 = (node.maxX[i] - ro.x) * invDir.x;
+        float ty0 = (node.minY[i] - ro.y) * invDir.y, ty1 = (node.maxY[i] - ro.y) * invDir.y;
+        float tz0 = (node.minZ[i] - ro.z) * invDir.z, tz1 = (node.maxZ[i] - ro.z) * invDir.z;
+        float enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+        float exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+        tEnter[i] = enter;
+        mask |= (enter <= exit && enter < tHit) ? 1u << i : 0u;
+    }
+    return mask & ((1u << node.childCount) - 1);
+}
+
+#if MBVH_SSE
+static unsigned intersect_children_sse(const MbvhNode<4>& node, const Vec3& ro, const Vec3& invDir, float tHit, float (&tEnter)[4])
+{
+    __m128 ox = _mm_set1_ps(ro.x), oy = _mm_set1_ps(ro.y), oz = _mm_set1_ps(ro.z);
+    __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+    __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), ox), ix);
+    __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), ox), ix);
+    __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), oy), iy);
+    __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), oy), iy);
+    __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), oz), iz);
+    __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), oz), iz);
+    __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+    __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_max_ps(tz0, tz1));
+    __m128 hit = _mm_and_ps(_mm_cmple_ps(enter, exit), _mm_cmplt_ps(enter, _mm_set1_ps(tHit)));
+    _mm_storeu_ps(tEnter, enter);
+    return static_cast<unsigned>(_mm_movemask_ps(hit)) & ((1u << node.childCount) - 1);
+}
+#endif
+
+#if CPU_X86
+CPU_TARGET("avx2")
+static unsigned intersect_children_avx(const MbvhNode<8>& node, const Vec3& ro, const Vec3& invDir, float tHit, float (&tEnter)[8])
+{
+    __m256 ox = _mm256_set1_ps(ro.x), oy = _mm256_set1_ps(ro.y), oz = _mm256_set1_ps(ro.z);
+    __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+    __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minX), ox), ix);
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxX), ox), ix);
+    __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minY), oy), iy);
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxY), oy), iy);
+    __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minZ), oz), iz);
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxZ), oz), iz);
+    __m256 enter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+                                 _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+    __m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_max_ps(tz0, tz1));
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ), _mm256_cmp_ps(enter, _mm256_set1_ps(tHit), _CMP_LT_OQ));
+    _mm256_storeu_ps(tEnter, enter);
+    return static_cast<unsigned>(_mm256_movemask_ps(hit)) & ((1u << node.childCount) - 1);
+}
+#endif
+
+template <>
+unsigned intersect_children<4>(const MbvhNode<4>& node, const Vec3& ro, const Vec3& invDir, float tHit, float (&tEnter)[4])
+{
+#if MBVH_SSE
+    return intersect_children_sse(node, ro, invDir, tHit, tEnter);
+#else
+    return intersect_children_scalar(node, ro, invDir, tHit, tEnter);
+#endif
+}
+
+template <>
+unsigned intersect_children<8>(const MbvhNode<8>& node, const Vec3& ro, const Vec3& invDir, float tHit, float (&tEnter)[8])
+{
+#if CPU_X86
+    // Checked once; the AVX test is compiled in whatever the build's flags
+    static const bool avx2 = cpu_supports(CpuFeatureAvx2);
+    if (avx2)
+        return intersect_children_avx(node, ro, invDir, tHit, tEnter);
+#endif
+    return intersect_children_scalar(node, ro, invDir, tHit, tEnter);
+}
+
+template Mbvh<4> collapse_bvh<4>(const Bvh& bvh);
+template Mbvh<8> collapse_bvh<8>(const Bvh& bvh);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+
+// Wide BVH node for the CPU tracer: up to Width children with their bounds
+// stored structure-of-arrays, so one ray is tested against every child box
+// with a single SIMD slab test. Children are packed at the front.
+template <int Width>
+struct alignas(32) MbvhNode
+{
+    float minX[Width], minY[Width], minZ[Width];
+    float maxX[Width], maxY[Width], maxZ[Width];
+    // Node index for interior children; first primIndices entry for leaves
+    uint32_t child[Width];
+    uint32_t count[Width];  // 0 for interior children
+    uint32_t childCount;
+};
+
+// Root is node 0 and always interior (a single-leaf tree becomes a root with
+// one leaf child). primIndices is shared with the binary tree it came from.
+template <int Width>
+struct Mbvh
+{
+    std::vector<MbvhNode<Width>> nodes;
+    std::vector<uint32_t> primIndices;
+};
+
+// Collapses a binary BVH by repeatedly opening the largest interior child
+// until a node has Width children. Leaves keep their primitive ranges, so
+// the depth never exceeds the binary tree's. Cheap enough to redo after a refit.
+template <int Width>
+Mbvh<Width> collapse_bvh(const Bvh& bvh);
+
+// Slab test of one ray against every child of node. Returns a bit per child
+// the ray enters before tHit and writes the entry distances into tEnter.
+template <int Width>
+unsigned intersect_children(const MbvhNode<Width>& node, const Vec3& ro, const Vec3& invDir, float tHit, float (&tEnter)[Width]);
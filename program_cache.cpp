@@ -0,0 +1,237 @@
+#include "program_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// Starts every cache file; version changes whenever the layout does
+struct ProgramBinaryHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+const char programBinaryMagic[4] = { 'R', 'T', 'P', 'B' };
+const uint32_t programBinaryVersion = 1;
+
+static const char* stage_name(GLenum type)
+{
+    switch (type)
+    {
+    case GL_VERTEX_SHADER: return "Vertex";
+    case GL_FRAGMENT_SHADER: return "Fragment";
+    case GL_COMPUTE_SHADER: return "Compute";
+    default: return "Unknown";
+    }
+}
+
+static std::string gl_string(GLenum name)
+{
+    const GLubyte* value = glGetString(name);
+    return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+// 64-bit FNV-1a
+static void hash_bytes(uint64_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+}
+
+void ProgramCache::init(const std::string& cacheDirectory)
+{
+    directory = cacheDirectory;
+    driver = gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" + gl_string(GL_VERSION);
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    binaries = formats > 0;
+    if (!directory.empty() && !binaries)
+    {
+        std::cerr << "The GL driver offers no program binary formats, compiling shaders from source\n";
+        directory.clear();
+    }
+}
+
+uint64_t ProgramCache::key(const std::vector<ShaderStage>& stages) const
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash_bytes(hash, driver.data(), driver.size());
+    for (const ShaderStage& stage : stages)
+    {
+        uint64_t length = stage.source.size();
+        hash_bytes(hash, &stage.type, sizeof(stage.type));
+        hash_bytes(hash, &length, sizeof(length));
+        hash_bytes(hash, stage.source.data(), stage.source.size());
+    }
+    return hash;
+}
+
+bool ProgramCache::read_binary(const std::string& path, uint64_t expectedKey, ProgramBinary& binary) const
+{
+    std::ifstream file(path, std::ios::binary);
+    ProgramBinaryHeader header;
+    if (!file.is_open() || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    if (std::memcmp(header.magic, programBinaryMagic, sizeof(header.magic)) != 0 || header.version != programBinaryVersion
+        || header.key != expectedKey || header.length == 0)
+    {
+        return false;
+    }
+    binary.format = header.format;
+    binary.data.resize(header.length);
+    return static_cast<bool>(file.read(binary.data.data(), binary.data.size()));
+}
+
+void ProgramCache::write_binary(const std::string& path, uint64_t programKey, const ProgramBinary& binary) const
+{
+    ProgramBinaryHeader header;
+    std::memcpy(header.magic, programBinaryMagic, sizeof(header.magic));
+    header.version = programBinaryVersion;
+    header.key = programKey;
+    header.format = binary.format;
+    header.length = static_cast<uint32_t>(binary.data.size());
+
+    // Written under a temporary name and renamed, so a concurrent launch
+    // never reads half a file
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data.data(), binary.data.size());
+        if (!file)
+        {
+            std::cerr << "Could not write program binary " << temporary << "\n";
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+}
+
+// A program from binary, or 0 if the driver rejects it
+static GLuint link_binary(GLenum format, const std::vector<char>& data)
+{
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, data.data(), static_cast<GLsizei>(data.size()));
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+GLuint ProgramCache::create_program(const std::vector<ShaderStage>& stages, const char* name)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    auto finish = [&](GLuint program)
+    {
+        totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        return program;
+    };
+
+    uint64_t programKey = key(stages);
+    auto cached = memory.find(programKey);
+    if (cached != memory.end())
+    {
+        if (GLuint program = link_binary(cached->second.format, cached->second.data))
+        {
+            cacheHits++;
+            return finish(program);
+        }
+        memory.erase(cached);
+    }
+
+    std::string path;
+    if (!directory.empty())
+    {
+        char file[32];
+        std::snprintf(file, sizeof(file), "%016llx.bin", static_cast<unsigned long long>(programKey));
+        path = (std::filesystem::path(directory) / file).string();
+        ProgramBinary binary;
+        if (read_binary(path, programKey, binary))
+        {
+            if (GLuint program = link_binary(binary.format, binary.data))
+            {
+                cacheHits++;
+                memory[programKey] = std::move(binary);
+                return finish(program);
+            }
+        }
+        // Missing, stale or rejected by the driver: compile and replace it
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+    int success;
+    char infoLog[512];
+    GLuint program = glCreateProgram();
+    std::vector<GLuint> shaders;
+    for (const ShaderStage& stage : stages)
+    {
+        const char* source = stage.source.c_str();
+        GLuint shader = glCreateShader(stage.type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+            std::cerr << stage_name(stage.type) << " shader compilation failed:\n" << infoLog << std::endl;
+        }
+        glAttachShader(program, shader);
+        shaders.push_back(shader);
+    }
+
+    if (binaries)
+    {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cerr << name << " linking failed:\n" << infoLog << std::endl;
+    }
+    for (GLuint shader : shaders)
+    {
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    compileCount++;
+
+    GLint length = 0;
+    if (success && binaries)
+    {
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    }
+    if (length > 0)
+    {
+        ProgramBinary binary;
+        binary.data.resize(length);
+        glGetProgramBinary(program, length, &length, &binary.format, binary.data.data());
+        binary.data.resize(length);
+        if (!path.empty())
+        {
+            write_binary(path, programKey, binary);
+        }
+        memory[programKey] = std::move(binary);
+    }
+    return finish(program);
+}
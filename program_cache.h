@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+
+// One stage of a program, with its #includes already expanded
+struct ShaderStage
+{
+    GLenum type;
+    std::string source;
+};
+
+// Linked programs kept on disk as glGetProgramBinary output, one file per
+// program named after a hash of its stage sources and the GL vendor,
+// renderer and version, so an edited shader or a driver update misses the
+// cache instead of loading a stale binary. A binary the driver rejects is
+// deleted and the program compiled from source and stored again. Every
+// binary also stays in memory for the rest of the run, so a program created
+// again, e.g. a shader variant switched back to, skips the disk as well.
+// init needs a current GL context.
+class ProgramCache
+{
+public:
+    // An empty directory keeps binaries in memory only.
+    void init(const std::string& directory);
+
+    // Creates a program from stages, named in error messages by name.
+    GLuint create_program(const std::vector<ShaderStage>& stages, const char* name);
+
+    // Programs loaded from memory or disk
+    int cache_hits() const { return cacheHits; }
+    int compiles() const { return compileCount; }
+    // Wall-clock time spent in create_program
+    double milliseconds() const { return totalMs; }
+
+private:
+    struct ProgramBinary
+    {
+        GLenum format;
+        std::vector<char> data;
+    };
+
+    uint64_t key(const std::vector<ShaderStage>& stages) const;
+    bool read_binary(const std::string& path, uint64_t expectedKey, ProgramBinary& binary) const;
+    void write_binary(const std::string& path, uint64_t programKey, const ProgramBinary& binary) const;
+
+    std::string directory;
+    bool binaries = false;  // whether the driver offers any binary format
+    std::unordered_map<uint64_t, ProgramBinary> memory;
+    std::string driver;
+    int cacheHits = 0;
+    int compileCount = 0;
+    double totalMs = 0.0;
+};
@@ -0,0 +1,406 @@
+// Scene storage, traversal and camera shared by the fragment, compute and
+// wavefront backends. Not a shader on its own: the stage files pull it in
+// with #include, which read_shader_from_source expands.
+
+// Switches a ShaderVariant can #define ahead of this; the defaults decide at
+// run time, so the general shader handles any scene. A variant defined as
+// true or false lets the compiler drop the other path entirely.
+#ifndef WATERTIGHT_TRIANGLES
+#define WATERTIGHT_TRIANGLES watertightTriangles
+#endif
+// Whether the scene has loose spheres, loose triangles and mesh instances
+#ifndef SCENE_SPHERES
+#define SCENE_SPHERES true
+#endif
+#ifndef SCENE_TRIANGLES
+#define SCENE_TRIANGLES true
+#endif
+#ifndef SCENE_INSTANCES
+#define SCENE_INSTANCES true
+#endif
+
+// Per-frame state written by FrameStateBuffer; the camera is the frame's
+// Camera, computed once on the CPU
+layout(std140, binding = 0) uniform FrameBlock
+{
+    vec4 cameraPos;         // xyz
+    vec4 cameraRight;       // xyz, aspect * tan(fovY / 2) long
+    vec4 cameraUp;          // xyz, tan(fovY / 2) long
+    vec4 cameraForward;     // xyz, unit
+    vec2 pixelSize;         // 1 / width, 1 / height
+    int windowWidth;
+    int windowHeight;
+    int sphereCount;
+    int triangleCount;
+    int nodeCount;
+    bool watertightTriangles;
+    vec2 sampleJitter;      // this sample's offset within the pixel
+    int sampleCount;        // samples since the history was cleared; seeds jitter and random numbers
+    int historyMode;        // HISTORY_* in temporal.glsl
+    vec4 previousCameraPos;     // the camera the history was traced with
+    vec4 previousCameraRight;
+    vec4 previousCameraUp;
+    vec4 previousCameraForward;
+};
+
+// std430 scene storage written by SceneBuffer
+layout(std430, binding = 0) readonly buffer SphereBuffer
+{
+    vec4 spheres[];     // center.xyz, radius
+};
+
+layout(std430, binding = 1) readonly buffer TriangleBuffer
+{
+    vec4 triangles[];   // v0, v1 - v0, v2 - v0 (v0, v1, v2 when watertight) per triangle; mesh triangles follow
+};
+
+// Depth-first BVH: the left child of node i is i + 1
+layout(std430, binding = 2) readonly buffer BvhNodeBuffer
+{
+    vec4 bvhNodes[];    // boundsMin + leftFirst bits, boundsMax + count bits
+};
+
+layout(std430, binding = 3) readonly buffer PrimitiveIndexBuffer
+{
+    uint primitiveIndices[];    // spheres, then triangles offset by sphereCount, then instances
+};
+
+layout(std430, binding = 4) readonly buffer InstanceBuffer
+{
+    vec4 instances[];   // world-to-object rows 0-2, then mesh root node bits in x
+};
+
+// All mesh BVHs, links already global: interior leftFirst indexes meshNodes,
+// leaf leftFirst indexes triangles directly
+layout(std430, binding = 5) readonly buffer MeshNodeBuffer
+{
+    vec4 meshNodes[];
+};
+
+// Must cover the builder's bvhMaxDepth
+const int BVH_STACK_SIZE = 32;
+const float NO_HIT = 1e30;
+
+const float PI = 3.1415926535897932384;
+
+bool intersectSphere(vec3 ro, vec3 rd, vec3 center, float radius, out float t)
+{
+    vec3 oc = ro - center;
+
+    // rd is unit length, so a = 1 and the factors of 2 cancel
+    float b = dot(oc, rd);
+    float c = dot(oc, oc) - radius * radius;
+
+    float discriminant = b*b - c;
+
+    if (discriminant < 0.0)
+        return false;
+
+    t = -b - sqrt(discriminant);
+    return t > 0.0;
+}
+
+// Moller-Trumbore with the edges precomputed on upload
+bool intersectTriangle(vec3 ro, vec3 rd, vec3 v0, vec3 edge1, vec3 edge2, out float t)
+{
+    vec3 p = cross(rd, edge2);
+    float det = dot(edge1, p);
+    if (abs(det) < 1e-8)
+        return false;
+
+    float invDet = 1.0 / det;
+    vec3 s = ro - v0;
+    float u = dot(s, p) * invDet;
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    vec3 q = cross(s, edge1);
+    float v = dot(rd, q) * invDet;
+    if (v < 0.0 || u + v > 1.0)
+        return false;
+
+    t = dot(edge2, q) * invDet;
+    return t > 0.0;
+}
+
+// Woop, Benthin and Wald: shear the vertices so the ray runs along +z from
+// the origin, then test the origin against the 2D edge functions. Both
+// triangles of an edge compute its function from the same vertices, and
+// precise keeps the compiler from fusing them differently, so no ray slips
+// through the crack between them.
+bool intersectTriangleWatertight(vec3 ro, vec3 rd, vec3 v0, vec3 v1, vec3 v2, out float t)
+{
+    vec3 absDir = abs(rd);
+    int kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    if (rd[kz] < 0.0)
+    {
+        int tmp = kx; kx = ky; ky = tmp;
+    }
+    vec3 shear = vec3(rd[kx], rd[ky], 1.0) / rd[kz];
+
+    vec3 a = v0 - ro;
+    vec3 b = v1 - ro;
+    vec3 c = v2 - ro;
+    precise float ax = a[kx] - shear.x * a[kz];
+    precise float ay = a[ky] - shear.y * a[kz];
+    precise float bx = b[kx] - shear.x * b[kz];
+    precise float by = b[ky] - shear.y * b[kz];
+    precise float cx = c[kx] - shear.x * c[kz];
+    precise float cy = c[ky] - shear.y * c[kz];
+
+    precise float u = cx * by - cy * bx;
+    precise float v = ax * cy - ay * cx;
+    precise float w = bx * ay - by * ax;
+    if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0))
+        return false;
+
+    float det = u + v + w;
+    if (det == 0.0)
+        return false;
+
+    t = shear.z * (u * a[kz] + v * b[kz] + w * c[kz]) / det;
+    return t > 0.0;
+}
+
+// Triangle i with whichever test its layout was uploaded for
+bool intersectTriangleAt(int i, vec3 ro, vec3 rd, out float t)
+{
+    int base = 3 * i;
+    if (WATERTIGHT_TRIANGLES)
+        return intersectTriangleWatertight(ro, rd, triangles[base].xyz, triangles[base + 1].xyz, triangles[base + 2].xyz, t);
+    return intersectTriangle(ro, rd, triangles[base].xyz, triangles[base + 1].xyz, triangles[base + 2].xyz, t);
+}
+
+// Entry distance of the ray into a box, or NO_HIT if it misses or starts
+// beyond the closest hit found so far
+float intersectBox(vec3 boundsMin, vec3 boundsMax, vec3 ro, vec3 invDir, float tHit)
+{
+    vec3 t0 = (boundsMin - ro) * invDir;
+    vec3 t1 = (boundsMax - ro) * invDir;
+    vec3 tMin = min(t0, t1);
+    vec3 tMax = max(t0, t1);
+    float tEnter = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+    float tExit = min(min(tMax.x, tMax.y), tMax.z);
+    return (tEnter <= tExit && tEnter < tHit) ? tEnter : NO_HIT;
+}
+
+float intersectNode(int node, vec3 ro, vec3 invDir, float tHit)
+{
+    return intersectBox(bvhNodes[2 * node].xyz, bvhNodes[2 * node + 1].xyz, ro, invDir, tHit);
+}
+
+float intersectMeshNode(int node, vec3 ro, vec3 invDir, float tHit)
+{
+    return intersectBox(meshNodes[2 * node].xyz, meshNodes[2 * node + 1].xyz, ro, invDir, tHit);
+}
+
+// Same traversal as traceScene over one mesh BVH, in that mesh's object space.
+// Only lowers tHit, so it can be called with the closest world hit so far;
+// hitTriangle is set to the triangles[] index of a closer hit.
+bool traceMesh(int root, vec3 ro, vec3 rd, inout float tHit, inout int hitTriangle)
+{
+    bool hit = false;
+    vec3 invDir = 1.0 / rd;
+    int stackNode[BVH_STACK_SIZE];
+    float stackDist[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = root;
+    if (intersectMeshNode(root, ro, invDir, tHit) == NO_HIT)
+        return false;
+
+    while (true)
+    {
+        uint leftFirst = floatBitsToUint(meshNodes[2 * node].w);
+        uint count = floatBitsToUint(meshNodes[2 * node + 1].w);
+        if (count > 0u)
+        {
+            for (uint i = 0u; i < count; i++)
+            {
+                float t;
+                if (intersectTriangleAt(int(leftFirst + i), ro, rd, t) && t < tHit)
+                {
+                    tHit = t;
+                    hitTriangle = int(leftFirst + i);
+                    hit = true;
+                }
+            }
+        }
+        else
+        {
+            int near = node + 1;
+            int far = int(leftFirst);
+            float dNear = intersectMeshNode(near, ro, invDir, tHit);
+            float dFar = intersectMeshNode(far, ro, invDir, tHit);
+            if (dFar < dNear)
+            {
+                int tmpNode = near; near = far; far = tmpNode;
+                float tmpDist = dNear; dNear = dFar; dFar = tmpDist;
+            }
+            if (dNear != NO_HIT)
+            {
+                if (dFar != NO_HIT)
+                {
+                    stackNode[stackSize] = far;
+                    stackDist[stackSize] = dFar;
+                    stackSize++;
+                }
+                node = near;
+                continue;
+            }
+        }
+
+        node = -1;
+        while (stackSize > 0)
+        {
+            stackSize--;
+            if (stackDist[stackSize] < tHit)
+            {
+                node = stackNode[stackSize];
+                break;
+            }
+        }
+        if (node < 0)
+            break;
+    }
+    return hit;
+}
+
+// On a closer hit, hitPrim becomes prim and hitTriangle the triangles[] index
+// for loose and mesh triangles
+void intersectPrimitive(uint prim, vec3 ro, vec3 rd, inout float tHit, inout uint hitPrim, inout int hitTriangle)
+{
+    float t;
+    uint instanceBase = uint(sphereCount + triangleCount);
+    if (SCENE_INSTANCES && prim >= instanceBase)
+    {
+        // Direction stays unnormalized so object-space t is the world-space t
+        int base = 4 * int(prim - instanceBase);
+        vec4 origin = vec4(ro, 1.0);
+        vec3 localOrigin = vec3(dot(instances[base], origin), dot(instances[base + 1], origin), dot(instances[base + 2], origin));
+        vec3 localDir = vec3(dot(instances[base].xyz, rd), dot(instances[base + 1].xyz, rd), dot(instances[base + 2].xyz, rd));
+        if (traceMesh(int(floatBitsToUint(instances[base + 3].x)), localOrigin, localDir, tHit, hitTriangle))
+            hitPrim = prim;
+    }
+    else if (SCENE_SPHERES && (!SCENE_TRIANGLES || prim < uint(sphereCount)))
+    {
+        vec4 sphere = spheres[prim];
+        if (intersectSphere(ro, rd, sphere.xyz, sphere.w, t) && t < tHit)
+        {
+            tHit = t;
+            hitPrim = prim;
+        }
+    }
+    else if (SCENE_TRIANGLES)
+    {
+        if (intersectTriangleAt(int(prim - uint(sphereCount)), ro, rd, t) && t < tHit)
+        {
+            tHit = t;
+            hitPrim = prim;
+            hitTriangle = int(prim - uint(sphereCount));
+        }
+    }
+}
+
+const uint NO_PRIMITIVE = 0xffffffffu;
+
+// Nearest hit, with the primitive id (NO_PRIMITIVE on a miss) and, for
+// triangles, the triangles[] index
+bool traceSceneHit(vec3 ro, vec3 rd, out float tHit, out uint hitPrim, out int hitTriangle)
+{
+    tHit = NO_HIT;
+    hitPrim = NO_PRIMITIVE;
+    hitTriangle = -1;
+    if (nodeCount == 0)
+        return false;
+
+    vec3 invDir = 1.0 / rd;
+    int stackNode[BVH_STACK_SIZE];
+    float stackDist[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = 0;
+    if (intersectNode(0, ro, invDir, tHit) == NO_HIT)
+        return false;
+
+    while (true)
+    {
+        uint leftFirst = floatBitsToUint(bvhNodes[2 * node].w);
+        uint count = floatBitsToUint(bvhNodes[2 * node + 1].w);
+        if (count > 0u)
+        {
+            for (uint i = 0u; i < count; i++)
+            {
+                intersectPrimitive(primitiveIndices[leftFirst + i], ro, rd, tHit, hitPrim, hitTriangle);
+            }
+        }
+        else
+        {
+            // Visit the nearer child first, keep the other for later
+            int near = node + 1;
+            int far = int(leftFirst);
+            float dNear = intersectNode(near, ro, invDir, tHit);
+            float dFar = intersectNode(far, ro, invDir, tHit);
+            if (dFar < dNear)
+            {
+                int tmpNode = near; near = far; far = tmpNode;
+                float tmpDist = dNear; dNear = dFar; dFar = tmpDist;
+            }
+            if (dNear != NO_HIT)
+            {
+                if (dFar != NO_HIT)
+                {
+                    stackNode[stackSize] = far;
+                    stackDist[stackSize] = dFar;
+                    stackSize++;
+                }
+                node = near;
+                continue;
+            }
+        }
+
+        // Pop, skipping nodes that start beyond the closest hit found since they were pushed
+        node = -1;
+        while (stackSize > 0)
+        {
+            stackSize--;
+            if (stackDist[stackSize] < tHit)
+            {
+                node = stackNode[stackSize];
+                break;
+            }
+        }
+        if (node < 0)
+            break;
+    }
+    return hitPrim != NO_PRIMITIVE;
+}
+
+bool traceScene(vec3 ro, vec3 rd, out float tHit)
+{
+    uint hitPrim;
+    int hitTriangle;
+    return traceSceneHit(ro, rd, tHit, hitPrim, hitTriangle);
+}
+
+// Unit world-space direction of the camera ray through pixelCoord, in window
+// pixels from the bottom-left corner, moved by the sample's jitter; the same
+// arithmetic as camera_ray_direction on the CPU
+vec3 cameraRayDirection(vec2 pixelCoord)
+{
+    vec2 uv = ((pixelCoord + sampleJitter) * pixelSize) * 2.0 - 1.0;
+    return normalize(cameraForward.xyz + cameraRight.xyz * uv.x + cameraUp.xyz * uv.y);
+}
+
+// Color of the primary ray through pixelCoord, with the ray's direction and
+// hit distance (NO_HIT on a miss); the fragment and compute backends' main()
+// call this
+vec4 shadePixel(vec2 pixelCoord, out vec3 rayDir, out float t)
+{
+    rayDir = cameraRayDirection(pixelCoord);
+    if(traceScene(cameraPos.xyz, rayDir, t))
+    {
+        return vec4(1.0, 0.0, 0.0, 1.0);
+    }
+    return vec4(0.0, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,55 @@
+#include "resolution_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Weight of the newest time in the smoothed one
+const double smoothing = 0.25;
+
+void ResolutionController::init(double budget, float lowestScale)
+{
+    budgetMs = budget;
+    minScale = std::clamp(lowestScale, scaleStep, 1.0f);
+    current = 1.0f;
+    minUsed = maxUsed = current;
+}
+
+bool ResolutionController::add_sample(double traceMs)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+    scaleSum += current;
+    sampleCount++;
+    if (settle > 0)
+    {
+        settle--;
+        return false;
+    }
+    smoothedMs = smoothed ? smoothedMs + smoothing * (traceMs - smoothedMs) : traceMs;
+    smoothed = true;
+
+    double ratio = smoothedMs / budgetMs;
+    if (ratio > 1.0 - upBand && ratio < 1.0 + downBand)
+    {
+        return false;
+    }
+    float target = current * static_cast<float>(std::sqrt(1.0 / std::max(ratio, 1e-3)));
+    // Outside the dead band, so at least one step
+    target = std::round(target / scaleStep) * scaleStep;
+    target = ratio > 1.0 ? std::min(target, current - scaleStep) : std::max(target, current + scaleStep);
+    target = std::clamp(target, minScale, 1.0f);
+    if (target == current)
+    {
+        return false;
+    }
+
+    current = target;
+    minUsed = std::min(minUsed, current);
+    maxUsed = std::max(maxUsed, current);
+    changeCount++;
+    smoothed = false;
+    settle = settleSamples;
+    return true;
+}
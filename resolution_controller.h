@@ -0,0 +1,45 @@
+#pragma once
+
+// Dynamic resolution: picks the render scale, the fraction of the window's
+// width and height that is traced, so the GPU trace time stays near a
+// budget. Trace time follows the pixel count, so a step aims at
+// scale * sqrt(budget / time), quantized to scaleStep. Times are smoothed,
+// and there is a dead band: the scale drops once the smoothed time is over
+// budget by downBand and only rises once it is under by upBand, which is
+// wider, so a scale near the budget doesn't flip back and forth. After a
+// change the next settleSamples times are ignored, since they may still
+// come from the old scale. A zero budget disables it at full scale.
+class ResolutionController
+{
+public:
+    static constexpr float scaleStep = 1.0f / 32.0f;
+    static constexpr double downBand = 0.05;
+    static constexpr double upBand = 0.2;
+    static const int settleSamples = 4;
+
+    void init(double budgetMs, float minScale);
+    bool enabled() const { return budgetMs > 0.0; }
+
+    // Feeds one trace time; true when the scale changed.
+    bool add_sample(double traceMs);
+    float scale() const { return current; }
+
+    int changes() const { return changeCount; }
+    float min_scale_used() const { return minUsed; }
+    float max_scale_used() const { return maxUsed; }
+    // Mean over the samples fed so far
+    float mean_scale() const { return sampleCount ? static_cast<float>(scaleSum / sampleCount) : current; }
+
+private:
+    double budgetMs = 0.0;
+    float minScale = 1.0f;
+    float current = 1.0f;
+    double smoothedMs = 0.0;
+    bool smoothed = false;
+    int settle = 0;
+    int changeCount = 0;
+    float minUsed = 1.0f;
+    float maxUsed = 1.0f;
+    double scaleSum = 0.0;
+    long long sampleCount = 0;
+};
@@ -0,0 +1,310 @@
+#include "scene.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+
+uint32_t add_mesh(Scene& scene, std::vector<Triangle> triangles)
+{
+    Mesh mesh;
+    mesh.boundsMin = Vec3(1e30f, 1e30f, 1e30f);
+    mesh.boundsMax = Vec3(-1e30f, -1e30f, -1e30f);
+    for (const Triangle& triangle : triangles)
+    {
+        mesh.boundsMin = min(mesh.boundsMin, min(triangle.v0, min(triangle.v1, triangle.v2)));
+        mesh.boundsMax = max(mesh.boundsMax, max(triangle.v0, max(triangle.v1, triangle.v2)));
+    }
+    mesh.triangles = std::move(triangles);
+    scene.meshes.push_back(std::move(mesh));
+    return static_cast<uint32_t>(scene.meshes.size() - 1);
+}
+
+Instance make_instance(uint32_t mesh, const Transform& objectToWorld)
+{
+    Instance instance;
+    instance.mesh = mesh;
+    instance.objectToWorld = objectToWorld;
+    instance.worldToObject = inverse(objectToWorld);
+    return instance;
+}
+
+// Unit torus around the y axis: ring radius 1, tube radius 0.3
+static std::vector<Triangle> make_torus(int rings, int sides)
+{
+    const float PI = 3.1415926535897932384f;
+    auto vertex = [&](int ring, int side)
+    {
+        float u = 2.0f * PI * ring / rings;
+        float v = 2.0f * PI * side / sides;
+        float r = 1.0f + 0.3f * std::cos(v);
+        return Vec3(r * std::cos(u), 0.3f * std::sin(v), r * std::sin(u));
+    };
+
+    std::vector<Triangle> triangles;
+    triangles.reserve(static_cast<size_t>(rings) * sides * 2);
+    for (int ring = 0; ring < rings; ring++)
+    {
+        for (int side = 0; side < sides; side++)
+        {
+            Vec3 a = vertex(ring, side), b = vertex(ring + 1, side);
+            Vec3 c = vertex(ring + 1, side + 1), d = vertex(ring, side + 1);
+            triangles.push_back({ a, b, c });
+            triangles.push_back({ a, c, d });
+        }
+    }
+    return triangles;
+}
+
+Scene make_default_scene()
+{
+    Scene scene;
+    scene.spheres.push_back({ Vec3(0.0f, 1.0f, -5.0f), 1.0f });
+    return scene;
+}
+
+Scene make_random_scene(int sphereCount, int triangleCount, int instanceCount, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> spreadX(-20.0f, 20.0f);
+    std::uniform_real_distribution<float> spreadY(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> spreadZ(-60.0f, -5.0f);
+    std::uniform_real_distribution<float> size(0.05f, 0.5f);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+
+    Scene scene;
+    scene.spheres.reserve(sphereCount);
+    for (int i = 0; i < sphereCount; i++)
+    {
+        scene.spheres.push_back({ Vec3(spreadX(rng), spreadY(rng), spreadZ(rng)), size(rng) });
+    }
+
+    scene.triangles.reserve(triangleCount);
+    for (int i = 0; i < triangleCount; i++)
+    {
+        Vec3 center(spreadX(rng), spreadY(rng), spreadZ(rng));
+        float extent = size(rng) * 2.0f;
+        Triangle triangle;
+        triangle.v0 = center + Vec3(offset(rng), offset(rng), offset(rng)) * extent;
+        triangle.v1 = center + Vec3(offset(rng), offset(rng), offset(rng)) * extent;
+        triangle.v2 = center + Vec3(offset(rng), offset(rng), offset(rng)) * extent;
+        scene.triangles.push_back(triangle);
+    }
+
+    if (instanceCount > 0)
+    {
+        uint32_t torus = add_mesh(scene, make_torus(32, 12));
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+        scene.instances.reserve(instanceCount);
+        for (int i = 0; i < instanceCount; i++)
+        {
+            Vec3 position(spreadX(rng), spreadY(rng), spreadZ(rng));
+            Transform placement = translation(position) * rotation_y(angle(rng)) * rotation_x(angle(rng)) * scaling(size(rng) * 2.0f);
+            scene.instances.push_back(make_instance(torus, placement));
+        }
+    }
+    return scene;
+}
+
+void animate_spheres(Scene& scene, const std::vector<Sphere>& rest, float time)
+{
+    for (size_t i = 0; i < scene.spheres.size() && i < rest.size(); i += 4)
+    {
+        // Spread phases and speeds so neighbours drift apart and the tree degrades
+        float phase = i * 0.7548776662f;
+        float speed = 0.5f + (i % 7) * 0.25f;
+        Vec3 offset(std::cos(time * speed + phase), std::sin(time * speed * 1.3f + phase), std::sin(time * speed + phase * 2.0f));
+        scene.spheres[i].center = rest[i].center + offset * 2.0f;
+    }
+}
+
+void animate_instances(Scene& scene, const std::vector<Instance>& rest, float time)
+{
+    for (size_t i = 0; i < scene.instances.size() && i < rest.size(); i += 4)
+    {
+        float speed = 0.5f + (i % 5) * 0.3f;
+        scene.instances[i] = make_instance(rest[i].mesh, rest[i].objectToWorld * rotation_y(time * speed));
+    }
+}
+
+// OBJ indices are 1-based and may be negative (relative to the end)
+static int resolve_obj_index(const std::string& token, int vertexCount)
+{
+    int index = std::atoi(token.c_str());
+    return index < 0 ? vertexCount + index : index - 1;
+}
+
+// Whether every entry of t is finite, which an inverse of a nearly singular
+// transform need not be
+static bool is_finite(const Transform& t)
+{
+    for (const auto& row : t.m)
+    {
+        for (float value : row)
+        {
+            if (!std::isfinite(value))
+                return false;
+        }
+    }
+    return true;
+}
+
+static std::string canonical_path(const std::filesystem::path& path)
+{
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path.string() : canonical.string();
+}
+
+// loading holds the canonical paths of this file and the files including it,
+// so a mesh line that includes one of them again is a cycle
+static bool load_scene_file(const std::string& path, Scene& scene, std::set<std::string>& loading)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not read scene " << path << "\n";
+        return false;
+    }
+
+    std::vector<Vec3> vertices;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::istringstream ss(line);
+        std::string keyword;
+        if (!(ss >> keyword) || keyword[0] == '#')
+        {
+            continue;
+        }
+
+        if (keyword == "sphere")
+        {
+            Sphere sphere;
+            if (!(ss >> sphere.center.x >> sphere.center.y >> sphere.center.z >> sphere.radius))
+            {
+                std::cerr << path << ":" << lineNumber << ": malformed sphere\n";
+                return false;
+            }
+            scene.spheres.push_back(sphere);
+        }
+        else if (keyword == "tri")
+        {
+            Triangle triangle;
+            if (!(ss >> triangle.v0.x >> triangle.v0.y >> triangle.v0.z
+                    >> triangle.v1.x >> triangle.v1.y >> triangle.v1.z
+                    >> triangle.v2.x >> triangle.v2.y >> triangle.v2.z))
+            {
+                std::cerr << path << ":" << lineNumber << ": malformed triangle\n";
+                return false;
+            }
+            scene.triangles.push_back(triangle);
+        }
+        else if (keyword == "mesh")
+        {
+            std::string meshFile;
+            if (!(ss >> meshFile))
+            {
+                std::cerr << path << ":" << lineNumber << ": malformed mesh\n";
+                return false;
+            }
+            std::filesystem::path meshPath(meshFile);
+            if (meshPath.is_relative())
+            {
+                meshPath = std::filesystem::path(path).parent_path() / meshPath;
+            }
+            std::string canonicalMesh = canonical_path(meshPath);
+            if (loading.count(canonicalMesh))
+            {
+                std::cerr << path << ":" << lineNumber << ": mesh include cycle\n";
+                return false;
+            }
+            Scene meshScene;
+            loading.insert(canonicalMesh);
+            bool loaded = load_scene_file(meshPath.string(), meshScene, loading);
+            loading.erase(canonicalMesh);
+            if (!loaded)
+            {
+                return false;
+            }
+            if (!meshScene.spheres.empty() || !meshScene.meshes.empty() || !meshScene.instances.empty())
+            {
+                std::cerr << path << ":" << lineNumber << ": mesh " << meshFile << " may only hold triangles\n";
+                return false;
+            }
+            if (meshScene.triangles.empty())
+            {
+                std::cerr << path << ":" << lineNumber << ": mesh " << meshFile << " has no triangles\n";
+                return false;
+            }
+            add_mesh(scene, std::move(meshScene.triangles));
+        }
+        else if (keyword == "instance")
+        {
+            uint32_t mesh;
+            Transform objectToWorld;
+            bool ok = static_cast<bool>(ss >> mesh);
+            for (int i = 0; i < 12 && ok; i++)
+            {
+                ok = static_cast<bool>(ss >> objectToWorld.m[i / 4][i % 4]);
+            }
+            if (!ok || mesh >= scene.meshes.size())
+            {
+                std::cerr << path << ":" << lineNumber << ": malformed instance or unknown mesh\n";
+                return false;
+            }
+            // Rays enter the mesh through the inverse, which a singular transform lacks
+            Instance instance = make_instance(mesh, objectToWorld);
+            float det = determinant(objectToWorld);
+            if (!std::isfinite(det) || det == 0.0f || !is_finite(instance.worldToObject))
+            {
+                std::cerr << path << ":" << lineNumber << ": malformed instance, its transform is singular\n";
+                return false;
+            }
+            scene.instances.push_back(instance);
+        }
+        else if (keyword == "v")
+        {
+            Vec3 vertex;
+            if (!(ss >> vertex.x >> vertex.y >> vertex.z))
+            {
+                std::cerr << path << ":" << lineNumber << ": malformed vertex\n";
+                return false;
+            }
+            vertices.push_back(vertex);
+        }
+        else if (keyword == "f")
+        {
+            // Only the position index of "v/vt/vn" matters here
+            std::vector<int> indices;
+            std::string token;
+            while (ss >> token)
+            {
+                int index = resolve_obj_index(token.substr(0, token.find('/')), static_cast<int>(vertices.size()));
+                if (index < 0 || index >= static_cast<int>(vertices.size()))
+                {
+                    std::cerr << path << ":" << lineNumber << ": face index out of range\n";
+                    return false;
+                }
+                indices.push_back(index);
+            }
+            for (size_t i = 2; i < indices.size(); i++)
+            {
+                scene.triangles.push_back({ vertices[indices[0]], vertices[indices[i - 1]], vertices[indices[i]] });
+            }
+        }
+    }
+    return true;
+}
+
+bool load_scene(const std::string& path, Scene& scene)
+{
+    std::set<std::string> loading = { canonical_path(path) };
+    return load_scene_file(path, scene, loading);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "vec3.h"
+#include "transform.h"
+
+struct Sphere
+{
+    Vec3 center;
+    float radius;
+};
+
+struct Triangle
+{
+    Vec3 v0, v1, v2;
+};
+
+// Object-space triangles shared by any number of instances. Each mesh gets
+// its own bottom-level BVH, built once however often its instances move.
+struct Mesh
+{
+    std::vector<Triangle> triangles;
+    Vec3 boundsMin, boundsMax;
+};
+
+// One placement of a mesh. The inverse is kept next to the transform so
+// traversal can move rays into object space without inverting per ray.
+struct Instance
+{
+    uint32_t mesh;
+    Transform objectToWorld;
+    Transform worldToObject;
+};
+
+// spheres and triangles are in world space; instances place meshes.
+struct Scene
+{
+    std::vector<Sphere> spheres;
+    std::vector<Triangle> triangles;
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+};
+
+// Appends a mesh with its bounds filled in and returns its index.
+uint32_t add_mesh(Scene& scene, std::vector<Triangle> triangles);
+Instance make_instance(uint32_t mesh, const Transform& objectToWorld);
+
+// The single sphere the shader used to hard-code.
+Scene make_default_scene();
+
+// Uniformly scattered spheres, small triangles and instances of one torus
+// mesh in front of the camera, for load tests.
+Scene make_random_scene(int sphereCount, int triangleCount, int instanceCount, unsigned seed);
+
+// Moves every fourth sphere along a small orbit around its rest position at
+// time seconds; the rest of the scene stays put. Drives the BVH refit path.
+void animate_spheres(Scene& scene, const std::vector<Sphere>& rest, float time);
+
+// Spins every fourth instance about its own y axis; only the top-level BVH
+// has to follow, the meshes are untouched.
+void animate_instances(Scene& scene, const std::vector<Instance>& rest, float time);
+
+// Text scene format, one primitive per line, '#' starts a comment:
+//   sphere cx cy cz radius
+//   tri x0 y0 z0 x1 y1 z1 x2 y2 z2
+//   mesh FILE                  triangles of another scene or OBJ file, relative
+//                              to this one, as the next mesh index; FILE may
+//                              only hold tri, v and f lines and not include
+//                              a file that is including it
+//   instance MESH m00 m01 m02 m03 m10 m11 m12 m13 m20 m21 m22 m23
+//                              row-major 3x4 object-to-world transform
+// OBJ "v" and "f" lines are also accepted, so plain meshes load directly;
+// polygons are fan-triangulated. An instance transform has to be invertible.
+bool load_scene(const std::string& path, Scene& scene);
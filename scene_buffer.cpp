@@ -0,0 +1,310 @@
+#include "scene_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Bytes per element of each region, in Region order
+const size_t regionStride[SceneBuffer::RegionCount] = {
+    4 * sizeof(float),
+    12 * sizeof(float),
+    sizeof(BvhNode),
+    sizeof(uint32_t),
+    16 * sizeof(float),
+    sizeof(BvhNode)
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the two-vec4 std430 layout");
+
+// Pending ranges of a slice's region past which they are merged into one
+const size_t pendingRangeLimit = 64;
+
+static size_t align_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+bool SceneBuffer::sliced(Region r)
+{
+    return r == SphereRegion || r == NodeRegion || r == InstanceRegion;
+}
+
+void SceneBuffer::init(TriangleTest test)
+{
+    triangleTest = test;
+    const size_t initial[RegionCount] = { 64, 64, 128, 128, 16, 128 };
+    allocate(initial);
+}
+
+void SceneBuffer::release()
+{
+    wait_for_gpu();
+    if (buffer)
+    {
+        glUnmapNamedBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+    }
+}
+
+void SceneBuffer::allocate(const size_t (&capacities)[RegionCount])
+{
+    release();
+
+    GLint alignment = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+    // The single regions, then slice 0 of the sliced ones, then the other slices
+    size_t bufferSize = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        size_t sliceBegin = align_up(bufferSize, alignment);
+        for (int r = 0; r < RegionCount; r++)
+        {
+            if (sliced(Region(r)) != (pass == 1))
+                continue;
+            capacity[r] = capacities[r];
+            offset[r] = align_up(bufferSize, alignment);
+            bufferSize = offset[r] + capacity[r] * regionStride[r];
+        }
+        if (pass == 1)
+        {
+            sliceStride = align_up(bufferSize - sliceBegin, alignment);
+            bufferSize = sliceBegin + sliceCount * sliceStride;
+        }
+    }
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, bufferSize, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapNamedBufferRange(buffer, 0, bufferSize, flags));
+
+    for (int r = 0; r < RegionCount; r++)
+    {
+        staging[r].assign(sliced(Region(r)) ? capacity[r] * regionStride[r] : 0, 0);
+        for (int s = 0; s < sliceCount; s++)
+        {
+            pending[s][r].clear();
+        }
+    }
+    slice = -1;
+}
+
+void SceneBuffer::wait_for_slice(int s)
+{
+    if (inFlight[s])
+    {
+        glClientWaitSync(inFlight[s], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(inFlight[s]);
+        inFlight[s] = nullptr;
+    }
+}
+
+void SceneBuffer::wait_for_gpu()
+{
+    for (int s = 0; s < sliceCount; s++)
+    {
+        wait_for_slice(s);
+    }
+}
+
+unsigned char* SceneBuffer::region(Region r, size_t element)
+{
+    if (sliced(r))
+    {
+        return staging[r].data() + element * regionStride[r];
+    }
+    return mapped + offset[r] + element * regionStride[r];
+}
+
+void SceneBuffer::mark_written(Region r, int first, int count)
+{
+    if (count <= 0)
+        return;
+    size_t begin = first * regionStride[r];
+    size_t end = (first + count) * regionStride[r];
+    for (int s = 0; s < sliceCount; s++)
+    {
+        std::vector<std::pair<size_t, size_t>>& ranges = pending[s][r];
+        if (ranges.size() < pendingRangeLimit)
+        {
+            ranges.emplace_back(begin, end);
+            continue;
+        }
+        // A refit touching many scattered ranges; one covering copy is cheaper than tracking them
+        for (const std::pair<size_t, size_t>& range : ranges)
+        {
+            begin = std::min(begin, range.first);
+            end = std::max(end, range.second);
+        }
+        ranges.assign(1, std::make_pair(begin, end));
+    }
+}
+
+void SceneBuffer::upload(const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs)
+{
+    size_t meshTriangles = 0;
+    size_t meshNodes = 0;
+    for (size_t m = 0; m < scene.meshes.size(); m++)
+    {
+        meshTriangles += scene.meshes[m].triangles.size();
+        meshNodes += meshBvhs[m].nodes.size();
+    }
+    const size_t needed[RegionCount] = {
+        scene.spheres.size(),
+        scene.triangles.size() + meshTriangles,
+        bvh.nodes.size(),
+        bvh.primIndices.size(),
+        scene.instances.size(),
+        meshNodes
+    };
+    bool fits = true;
+    for (int r = 0; r < RegionCount; r++)
+    {
+        fits = fits && needed[r] <= capacity[r];
+    }
+    if (!fits)
+    {
+        // Grow geometrically so a scene that keeps growing doesn't reallocate on every upload
+        size_t grown[RegionCount];
+        for (int r = 0; r < RegionCount; r++)
+        {
+            grown[r] = std::max(needed[r], capacity[r] * 2);
+        }
+        allocate(grown);
+    }
+
+    // The single regions are overwritten in place
+    wait_for_gpu();
+    sphereCount = static_cast<int>(scene.spheres.size());
+    triangleCount = static_cast<int>(scene.triangles.size());
+    nodeCount = static_cast<int>(bvh.nodes.size());
+    write_spheres(scene.spheres.data(), 0, sphereCount);
+    write_triangles(scene.triangles.data(), 0, triangleCount);
+    write_nodes(bvh.nodes.data(), 0, nodeCount);
+    std::memcpy(region(IndexRegion, 0), bvh.primIndices.data(), bvh.primIndices.size() * sizeof(uint32_t));
+
+    uint32_t triangleBase = static_cast<uint32_t>(scene.triangles.size());
+    uint32_t nodeBase = 0;
+    meshRoots.clear();
+    for (size_t m = 0; m < scene.meshes.size(); m++)
+    {
+        const Mesh& mesh = scene.meshes[m];
+        const Bvh& meshBvh = meshBvhs[m];
+        std::vector<Triangle> ordered(meshBvh.primIndices.size());
+        for (size_t i = 0; i < ordered.size(); i++)
+        {
+            ordered[i] = mesh.triangles[meshBvh.primIndices[i]];
+        }
+        write_triangles(ordered.data(), triangleBase, static_cast<int>(ordered.size()));
+
+        BvhNode* out = reinterpret_cast<BvhNode*>(region(MeshNodeRegion, nodeBase));
+        for (const BvhNode& node : meshBvh.nodes)
+        {
+            *out = node;
+            out->leftFirst += node.is_leaf() ? triangleBase : nodeBase;
+            out++;
+        }
+        meshRoots.push_back(nodeBase);
+        triangleBase += static_cast<uint32_t>(ordered.size());
+        nodeBase += static_cast<uint32_t>(meshBvh.nodes.size());
+    }
+
+    instanceCount = static_cast<int>(scene.instances.size());
+    write_instances(scene.instances.data(), 0, instanceCount);
+}
+
+void SceneBuffer::write_spheres(const Sphere* spheres, int first, int count)
+{
+    float* out = reinterpret_cast<float*>(region(SphereRegion, first));
+    for (int i = 0; i < count; i++, out += 4)
+    {
+        const Sphere& sphere = spheres[i];
+        out[0] = sphere.center.x;
+        out[1] = sphere.center.y;
+        out[2] = sphere.center.z;
+        out[3] = sphere.radius;
+    }
+    mark_written(SphereRegion, first, count);
+}
+
+void SceneBuffer::write_triangles(const Triangle* triangles, int first, int count)
+{
+    wait_for_gpu();
+    float* out = reinterpret_cast<float*>(region(TriangleRegion, first));
+    for (int i = 0; i < count; i++, out += 12)
+    {
+        const Triangle& triangle = triangles[i];
+        // The watertight test needs the exact vertices shared between triangles
+        bool edges = triangleTest == TriangleTestMollerTrumbore;
+        Vec3 p1 = edges ? triangle.v1 - triangle.v0 : triangle.v1;
+        Vec3 p2 = edges ? triangle.v2 - triangle.v0 : triangle.v2;
+        const float packed[12] = {
+            triangle.v0.x, triangle.v0.y, triangle.v0.z, 0.0f,
+            p1.x, p1.y, p1.z, 0.0f,
+            p2.x, p2.y, p2.z, 0.0f
+        };
+        std::memcpy(out, packed, sizeof(packed));
+    }
+}
+
+void SceneBuffer::write_nodes(const BvhNode* nodes, int first, int count)
+{
+    std::memcpy(region(NodeRegion, first), nodes, count * sizeof(BvhNode));
+    mark_written(NodeRegion, first, count);
+}
+
+void SceneBuffer::write_instances(const Instance* instances, int first, int count)
+{
+    float* out = reinterpret_cast<float*>(region(InstanceRegion, first));
+    for (int i = 0; i < count; i++, out += 16)
+    {
+        const Instance& instance = instances[i];
+        std::memcpy(out, instance.worldToObject.m, 12 * sizeof(float));
+        uint32_t root = meshRoots[instance.mesh];
+        std::memcpy(out + 12, &root, sizeof(root));
+        out[13] = out[14] = out[15] = 0.0f;
+    }
+    mark_written(InstanceRegion, first, count);
+}
+
+void SceneBuffer::bind()
+{
+    bool current = slice >= 0;
+    for (int r = 0; r < RegionCount && current; r++)
+    {
+        current = pending[slice][r].empty();
+    }
+
+    if (!current)
+    {
+        slice = (slice + 1) % sliceCount;
+        wait_for_slice(slice);
+        for (int r = 0; r < RegionCount; r++)
+        {
+            if (!sliced(Region(r)))
+                continue;
+            unsigned char* out = mapped + offset[r] + slice * sliceStride;
+            for (const std::pair<size_t, size_t>& range : pending[slice][r])
+            {
+                std::memcpy(out + range.first, staging[r].data() + range.first, range.second - range.first);
+            }
+            pending[slice][r].clear();
+        }
+    }
+
+    for (int r = 0; r < RegionCount; r++)
+    {
+        size_t begin = offset[r] + (sliced(Region(r)) ? slice * sliceStride : 0);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, r, buffer, begin, capacity[r] * regionStride[r]);
+    }
+}
+
+void SceneBuffer::fence()
+{
+    if (inFlight[slice])
+    {
+        glDeleteSync(inFlight[slice]);
+    }
+    inFlight[slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include "scene.h"
+#include "bvh.h"
+#include "triangle_kernel.h"
+
+// Scene primitives and their BVH in one persistently mapped shader storage
+// buffer, laid out std430 as regions that the shaders see as separate blocks:
+//   binding 0: vec4 spheres[]          (center.xyz, radius)
+//   binding 1: vec4 triangles[3 * n]   (v0, v1 - v0, v2 - v0; v0, v1, v2 when watertight)
+//   binding 2: vec4 bvhNodes[2 * n]    (boundsMin, leftFirst bits; boundsMax, count bits)
+//   binding 3: uint primitiveIndices[]
+//   binding 4: vec4 instances[4 * n]   (world-to-object rows, mesh root node bits)
+//   binding 5: vec4 meshNodes[2 * n]   (every mesh BVH, same node layout)
+// Mesh triangles follow the scene's own triangles, reordered so each mesh
+// leaf covers a contiguous run; mesh node links are rebased to global
+// indices, so traversal needs neither per-mesh offsets nor an index list.
+// The storage is only reallocated when a scene outgrows it.
+//
+// The regions an animation rewrites every frame (spheres, BVH nodes and
+// instances) have sliceCount slices, like the ring in FrameStateBuffer:
+// write_spheres, write_nodes and write_instances only change a CPU copy, and
+// bind() copies what changed into the next slice once the fence of the last
+// frame reading that slice has passed, so the CPU refits and uploads frame
+// N + 1 while the GPU still traces frame N. The other regions are single and
+// only change on a full upload, which waits for every frame in flight.
+// init and release need a current GL context.
+class SceneBuffer
+{
+public:
+    static const int sliceCount = 3;
+
+    enum Region
+    {
+        SphereRegion,
+        TriangleRegion,
+        NodeRegion,
+        IndexRegion,
+        InstanceRegion,
+        MeshNodeRegion,
+        RegionCount
+    };
+
+    // The triangle test fixes the triangle layout for the buffer's lifetime
+    void init(TriangleTest test = TriangleTestMollerTrumbore);
+    void release();
+
+    void upload(const Scene& scene, const Bvh& bvh, const std::vector<Bvh>& meshBvhs);
+    // Overwrite elements [first, first + count); the frames see them from the next bind().
+    void write_spheres(const Sphere* spheres, int first, int count);
+    void write_nodes(const BvhNode* nodes, int first, int count);
+    void write_instances(const Instance* instances, int first, int count);
+    // Triangles are not sliced, so this waits for every frame that may read them.
+    void write_triangles(const Triangle* triangles, int first, int count);
+
+    // Copies the pending writes into the next slice, if there are any, and
+    // binds region i to shader storage binding i. Call before the frame's draws.
+    void bind();
+    // Call after the draws that read the buffer so the slice is not overwritten under them.
+    void fence();
+
+    int sphere_count() const { return sphereCount; }
+    int triangle_count() const { return triangleCount; }
+    int node_count() const { return nodeCount; }
+    int instance_count() const { return instanceCount; }
+    TriangleTest triangle_test() const { return triangleTest; }
+
+private:
+    static bool sliced(Region r);
+
+    void allocate(const size_t (&capacities)[RegionCount]);
+    void wait_for_slice(int s);
+    void wait_for_gpu();
+    // Where element goes: the mapping for single regions, the CPU copy for sliced ones
+    unsigned char* region(Region r, size_t element);
+    void mark_written(Region r, int first, int count);
+
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t capacity[RegionCount] = {};
+    // Of slice 0 for sliced regions; slice s starts s * sliceStride later
+    size_t offset[RegionCount] = {};
+    size_t sliceStride = 0;
+    int slice = -1;
+    std::vector<unsigned char> staging[RegionCount];
+    // Byte ranges of staging written since each slice last received them
+    std::vector<std::pair<size_t, size_t>> pending[sliceCount][RegionCount];
+    GLsync inFlight[sliceCount] = {};
+    int sphereCount = 0;
+    int triangleCount = 0;
+    int nodeCount = 0;
+    int instanceCount = 0;
+    TriangleTest triangleTest = TriangleTestMollerTrumbore;
+    // First meshNodes entry of each mesh, written into its instances
+    std::vector<uint32_t> meshRoots;
+};
@@ -0,0 +1,451 @@
+#include "shader_reload.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <GLFW/glfw3.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// GL_KHR_parallel_shader_compile, which the core profile loader leaves out
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static std::string canonical_path(const std::string& path)
+{
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path : canonical.string();
+}
+
+// expanding holds the canonical paths of the files whose includes are being
+// expanded, so a file that includes itself, directly or through others, is
+// caught instead of recursing forever
+static bool expand_shader(const std::string& path, std::vector<std::string>* files, std::set<std::string>& expanding, std::stringstream& ss)
+{
+    std::ifstream file_stream(path);
+    if (!file_stream.is_open())
+    {
+        std::cerr << "Could not read file from source: " << path << "\n";
+        return false;
+    }
+    if (files)
+    {
+        files->push_back(path);
+    }
+
+    const std::string includeDirective = "#include \"";
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file_stream, line))
+    {
+        lineNumber++;
+        if (line.compare(0, includeDirective.size(), includeDirective) == 0)
+        {
+            size_t end = line.find('"', includeDirective.size());
+            std::string name = line.substr(includeDirective.size(), end - includeDirective.size());
+            std::string included = (std::filesystem::path(path).parent_path() / name).string();
+            std::string canonicalIncluded = canonical_path(included);
+            if (expanding.count(canonicalIncluded))
+            {
+                std::cerr << path << ":" << lineNumber << ": shader include cycle\n";
+                return false;
+            }
+            expanding.insert(canonicalIncluded);
+            bool expanded = expand_shader(included, files, expanding, ss);
+            expanding.erase(canonicalIncluded);
+            if (!expanded)
+                return false;
+            ss << "\n";
+            continue;
+        }
+        ss << line << "\n";
+    }
+    return true;
+}
+
+std::string read_shader_from_source(const char* pathToFile, std::vector<std::string>* files)
+{
+    std::set<std::string> expanding = { canonical_path(pathToFile) };
+    std::stringstream ss;
+    if (!expand_shader(pathToFile, files, expanding, ss))
+        return "";
+    return ss.str();
+}
+
+std::vector<ShaderStage> read_shader_stages(const std::vector<ShaderFile>& files, const ShaderVariant& variant,
+                                            std::vector<std::string>* dependencies)
+{
+    std::vector<ShaderStage> stages;
+    for (const ShaderFile& file : files)
+    {
+        stages.push_back({ file.type, variant.apply(read_shader_from_source(file.path.c_str(), dependencies)) });
+    }
+    return stages;
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Compiles and links stages into a new program without querying any status,
+// which with parallel compilation would wait for the driver
+static GLuint compile_program(const std::vector<ShaderStage>& stages, std::vector<GLuint>& shaders)
+{
+    GLuint program = glCreateProgram();
+    for (const ShaderStage& stage : stages)
+    {
+        const char* source = stage.source.c_str();
+        GLuint shader = glCreateShader(stage.type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        glAttachShader(program, shader);
+        shaders.push_back(shader);
+    }
+    glLinkProgram(program);
+    return program;
+}
+
+bool ShaderReloader::init(GLFWwindow* window)
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; i++)
+    {
+        const GLubyte* extension = glGetStringi(GL_EXTENSIONS, i);
+        if (extension && std::strcmp(reinterpret_cast<const char*>(extension), "GL_KHR_parallel_shader_compile") == 0)
+        {
+            parallelCompile = true;
+        }
+    }
+
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        std::cerr << "Could not start watching shader files: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    if (!parallelCompile)
+    {
+        start_compile_thread(window);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ShaderReloader::start_compile_thread(GLFWwindow* window)
+{
+    // The render window's context hints are still set, which sharing needs
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    compileWindow = glfwCreateWindow(1, 1, "Shader compiler", nullptr, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!compileWindow)
+    {
+        std::cout << "Neither GL_KHR_parallel_shader_compile nor a shared context for compiling is available, "
+                     "so shader reloads stall frames while they compile\n";
+        return;
+    }
+    compileThread = std::thread(&ShaderReloader::compile_loop, this);
+}
+
+void ShaderReloader::compile_loop()
+{
+    glfwMakeContextCurrent(compileWindow);
+    std::unique_lock<std::mutex> lock(compileMutex);
+    for (;;)
+    {
+        compileWake.wait(lock, [this] { return stopCompiling || !compileJobs.empty(); });
+        if (stopCompiling)
+            break;
+        CompileJob job = std::move(compileJobs.front());
+        compileJobs.erase(compileJobs.begin());
+        lock.unlock();
+
+        Rebuild rebuild{ job.watched, 0, {}, job.startTime, job.generation };
+        rebuild.program = compile_program(job.stages, rebuild.shaders);
+        // Another context may only use the objects once the commands that built them have completed
+        glFinish();
+
+        lock.lock();
+        compiled.push_back(std::move(rebuild));
+    }
+    lock.unlock();
+    glfwMakeContextCurrent(nullptr);
+}
+
+void ShaderReloader::release()
+{
+    if (compileThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(compileMutex);
+            stopCompiling = true;
+        }
+        compileWake.notify_one();
+        compileThread.join();
+    }
+    compileJobs.clear();
+    for (Rebuild& rebuild : compiled)
+    {
+        discard(rebuild);
+    }
+    compiled.clear();
+    if (compileWindow)
+    {
+        glfwDestroyWindow(compileWindow);
+        compileWindow = nullptr;
+    }
+
+    for (Rebuild& rebuild : rebuilds)
+    {
+        discard(rebuild);
+    }
+    rebuilds.clear();
+#ifdef __linux__
+    if (inotifyFd >= 0)
+    {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+    directories.clear();
+    programs.clear();
+}
+
+void ShaderReloader::add_directory(const std::string& directory)
+{
+#ifdef __linux__
+    for (const auto& watchedDirectory : directories)
+    {
+        if (watchedDirectory.second == directory)
+        {
+            return;
+        }
+    }
+    // Editors often save by writing a new file and renaming it over the old one
+    int descriptor = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (descriptor < 0)
+    {
+        std::cerr << "Could not watch " << directory << ": " << std::strerror(errno) << "\n";
+        return;
+    }
+    directories.push_back({ descriptor, directory });
+#endif
+}
+
+void ShaderReloader::watch(int id, const std::vector<ShaderFile>& files, const ShaderVariant& variant, const char* name)
+{
+    if (inotifyFd < 0)
+    {
+        return;
+    }
+    Watched watched{ id, files, variant, {}, name };
+    std::vector<std::string> dependencies;
+    read_shader_stages(files, variant, &dependencies);
+    for (const std::string& dependency : dependencies)
+    {
+        std::string path = canonical_path(dependency);
+        if (std::find(watched.dependencies.begin(), watched.dependencies.end(), path) == watched.dependencies.end())
+        {
+            watched.dependencies.push_back(path);
+            add_directory(std::filesystem::path(path).parent_path().string());
+        }
+    }
+    programs.push_back(std::move(watched));
+}
+
+std::vector<std::string> ShaderReloader::changed_files()
+{
+    std::vector<std::string> changed;
+#ifdef __linux__
+    alignas(inotify_event) char events[4096];
+    for (;;)
+    {
+        ssize_t length = read(inotifyFd, events, sizeof(events));
+        if (length <= 0)
+        {
+            break;
+        }
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(events + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if (event->len == 0)
+            {
+                continue;
+            }
+            for (const auto& directory : directories)
+            {
+                if (directory.first == event->wd)
+                {
+                    changed.push_back((std::filesystem::path(directory.second) / event->name).string());
+                }
+            }
+        }
+    }
+#endif
+    return changed;
+}
+
+void ShaderReloader::discard(Rebuild& rebuild)
+{
+    for (GLuint shader : rebuild.shaders)
+    {
+        glDeleteShader(shader);
+    }
+    glDeleteProgram(rebuild.program);
+}
+
+void ShaderReloader::start_rebuild(size_t watched)
+{
+    for (size_t i = 0; i < rebuilds.size(); i++)
+    {
+        if (rebuilds[i].watched == watched)
+        {
+            discard(rebuilds[i]);
+            rebuilds.erase(rebuilds.begin() + i);
+            break;
+        }
+    }
+
+    // The includes may have changed too, so the dependencies are read again
+    Watched& program = programs[watched];
+    std::vector<std::string> dependencies;
+    std::vector<ShaderStage> stages = read_shader_stages(program.files, program.variant, &dependencies);
+    for (const std::string& dependency : dependencies)
+    {
+        std::string path = canonical_path(dependency);
+        if (std::find(program.dependencies.begin(), program.dependencies.end(), path) == program.dependencies.end())
+        {
+            program.dependencies.push_back(path);
+            add_directory(std::filesystem::path(path).parent_path().string());
+        }
+    }
+
+    // Whatever the compile thread still has in flight for this program is stale from here on
+    program.generation++;
+    for (const ShaderStage& stage : stages)
+    {
+        if (stage.source.empty())
+        {
+            std::cerr << "Reloading " << program.name << " failed, keeping the previous program\n";
+            return;
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    if (compileWindow)
+    {
+        std::lock_guard<std::mutex> lock(compileMutex);
+        compileJobs.erase(std::remove_if(compileJobs.begin(), compileJobs.end(),
+                                         [watched](const CompileJob& job) { return job.watched == watched; }),
+                          compileJobs.end());
+        compileJobs.push_back({ watched, program.generation, std::move(stages), startTime });
+        compileWake.notify_one();
+        return;
+    }
+
+    Rebuild rebuild{ watched, 0, {}, startTime, program.generation };
+    rebuild.program = compile_program(stages, rebuild.shaders);
+    rebuilds.push_back(std::move(rebuild));
+}
+
+std::vector<ReloadedProgram> ShaderReloader::update()
+{
+    std::vector<ReloadedProgram> reloaded;
+    if (inotifyFd < 0)
+    {
+        return reloaded;
+    }
+
+    std::vector<std::string> changed = changed_files();
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        for (const std::string& path : changed)
+        {
+            if (std::find(programs[i].dependencies.begin(), programs[i].dependencies.end(), canonical_path(path)) != programs[i].dependencies.end())
+            {
+                start_rebuild(i);
+                break;
+            }
+        }
+    }
+
+    if (compileWindow)
+    {
+        std::lock_guard<std::mutex> lock(compileMutex);
+        for (Rebuild& rebuild : compiled)
+        {
+            if (rebuild.generation == programs[rebuild.watched].generation)
+            {
+                rebuilds.push_back(std::move(rebuild));
+            }
+            else
+            {
+                discard(rebuild);
+            }
+        }
+        compiled.clear();
+    }
+
+    for (size_t i = 0; i < rebuilds.size();)
+    {
+        Rebuild& rebuild = rebuilds[i];
+        int complete = GL_TRUE;
+        if (parallelCompile)
+        {
+            glGetProgramiv(rebuild.program, GL_COMPLETION_STATUS_KHR, &complete);
+        }
+        if (!complete)
+        {
+            i++;
+            continue;
+        }
+
+        const Watched& program = programs[rebuild.watched];
+        int success;
+        glGetProgramiv(rebuild.program, GL_LINK_STATUS, &success);
+        if (success)
+        {
+            std::cout << "Reloaded " << program.name << " in " << milliseconds_since(rebuild.startTime) << " ms\n";
+            for (GLuint shader : rebuild.shaders)
+            {
+                glDetachShader(rebuild.program, shader);
+                glDeleteShader(shader);
+            }
+            reloaded.push_back({ program.id, rebuild.program });
+        }
+        else
+        {
+            char infoLog[512];
+            for (GLuint shader : rebuild.shaders)
+            {
+                glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+                if (!success)
+                {
+                    glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+                    std::cerr << "Shader compilation failed:\n" << infoLog << std::endl;
+                }
+            }
+            glGetProgramInfoLog(rebuild.program, 512, nullptr, infoLog);
+            std::cerr << "Reloading " << program.name << " failed after " << milliseconds_since(rebuild.startTime)
+                      << " ms, keeping the previous program:\n" << infoLog << std::endl;
+            discard(rebuild);
+        }
+        rebuilds.erase(rebuilds.begin() + i);
+    }
+    return reloaded;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glad/glad.h>
+#include "program_cache.h"
+#include "shader_variant.h"
+
+struct GLFWwindow;
+
+// GLSL has no includes, so #include "FILE" lines are expanded here, with
+// FILE relative to the including shader. Every file read, the shader itself
+// first, is appended to files when given. Returns an empty string when a
+// file can't be read or includes itself, directly or through other files.
+std::string read_shader_from_source(const char* pathToFile, std::vector<std::string>* files = nullptr);
+
+// Where one stage of a program comes from
+struct ShaderFile
+{
+    GLenum type;
+    std::string path;
+};
+
+// Reads and expands every stage of a program, specialized to variant.
+std::vector<ShaderStage> read_shader_stages(const std::vector<ShaderFile>& files, const ShaderVariant& variant,
+                                            std::vector<std::string>* dependencies = nullptr);
+
+// A program rebuilt after one of its files changed; the caller swaps it in
+// for the program it watched under id and deletes the old one.
+struct ReloadedProgram
+{
+    int id;
+    GLuint program;
+};
+
+// Hot reload: inotify watches the directories of every file a watched
+// program was built from, includes too, and a change recompiles the program
+// without blocking the frame. With GL_KHR_parallel_shader_compile the driver
+// compiles and links on its own threads and update polls for completion.
+// Without it a worker thread compiles and links on a hidden window whose
+// context shares objects with the render window's, and update collects the
+// programs it finished; only if that context can't be created do rebuilds
+// compile on the render thread and stall it, which init reports. Only a
+// program that linked is handed back, so a broken edit keeps the previous
+// program running. Another change while a rebuild is pending restarts it.
+// Linux only; elsewhere init fails and nothing reloads.
+// init, update and release need window's context current on the calling thread.
+class ShaderReloader
+{
+public:
+    ShaderReloader() = default;
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    bool init(GLFWwindow* window);
+    void release();
+
+    void watch(int id, const std::vector<ShaderFile>& files, const ShaderVariant& variant, const char* name);
+
+    // Reads the pending file events, starts rebuilds of the programs they
+    // touch and returns the rebuilds that have linked since the last call.
+    std::vector<ReloadedProgram> update();
+
+private:
+    struct Watched
+    {
+        int id;
+        std::vector<ShaderFile> files;
+        ShaderVariant variant;
+        std::vector<std::string> dependencies;  // canonical paths
+        std::string name;
+        unsigned generation = 0;  // bumped by every rebuild, so stale ones are dropped
+    };
+
+    struct Rebuild
+    {
+        size_t watched;
+        GLuint program;
+        std::vector<GLuint> shaders;
+        std::chrono::steady_clock::time_point startTime;
+        unsigned generation;
+    };
+
+    // A rebuild waiting for the compile thread
+    struct CompileJob
+    {
+        size_t watched;
+        unsigned generation;
+        std::vector<ShaderStage> stages;
+        std::chrono::steady_clock::time_point startTime;
+    };
+
+    void add_directory(const std::string& directory);
+    std::vector<std::string> changed_files();
+    void start_rebuild(size_t watched);
+    void discard(Rebuild& rebuild);
+    void start_compile_thread(GLFWwindow* window);
+    void compile_loop();
+
+    int inotifyFd = -1;
+    std::vector<std::pair<int, std::string>> directories;  // watch descriptor, canonical directory
+    std::vector<Watched> programs;
+    std::vector<Rebuild> rebuilds;
+    bool parallelCompile = false;
+
+    GLFWwindow* compileWindow = nullptr;
+    std::thread compileThread;
+    std::mutex compileMutex;
+    std::condition_variable compileWake;
+    // Guarded by compileMutex
+    std::vector<CompileJob> compileJobs;
+    std::vector<Rebuild> compiled;
+    bool stopCompiling = false;
+};
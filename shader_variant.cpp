@@ -0,0 +1,55 @@
+#include "shader_variant.h"
+
+#include <algorithm>
+
+void ShaderVariant::define(const std::string& name, const std::string& value)
+{
+    auto it = std::lower_bound(defines.begin(), defines.end(), name,
+                               [](const std::pair<std::string, std::string>& define, const std::string& key) { return define.first < key; });
+    if (it != defines.end() && it->first == name)
+    {
+        it->second = value;
+        return;
+    }
+    defines.insert(it, { name, value });
+}
+
+std::string ShaderVariant::define_block() const
+{
+    std::string block;
+    for (const auto& define : defines)
+    {
+        block += "#define " + define.first + " " + define.second + "\n";
+    }
+    return block;
+}
+
+std::string ShaderVariant::apply(const std::string& source) const
+{
+    if (defines.empty())
+    {
+        return source;
+    }
+    // #version has to stay the first statement, so the block goes after it
+    size_t version = source.find("#version");
+    if (version == std::string::npos)
+    {
+        return define_block() + source;
+    }
+    size_t lineEnd = source.find('\n', version);
+    if (lineEnd == std::string::npos)
+    {
+        return source + "\n" + define_block();
+    }
+    return source.substr(0, lineEnd + 1) + define_block() + source.substr(lineEnd + 1);
+}
+
+std::string ShaderVariant::name() const
+{
+    std::string result;
+    for (const auto& define : defines)
+    {
+        result += (result.empty() ? "" : " ") + define.first + "=" + define.second;
+    }
+    return result.empty() ? "default" : result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// One permutation of a shader: #defines compiled into it so switches that
+// hold for a whole run become constants the compiler folds away, instead of
+// uniform branches that cost registers in every invocation. The block is
+// inserted right after the #version line; the shaders give every switch a
+// default under #ifndef, so an empty variant is the general shader. Two
+// variants with the same defines produce the same source, and so share
+// ProgramCache entries.
+class ShaderVariant
+{
+public:
+    // Adds or replaces a define; defines are kept sorted by name.
+    void define(const std::string& name, const std::string& value);
+    void define(const std::string& name, const char* value) { define(name, std::string(value)); }
+    void define(const std::string& name, bool value) { define(name, std::string(value ? "true" : "false")); }
+    void define(const std::string& name, int value) { define(name, std::to_string(value)); }
+
+    // The #define lines, one per define
+    std::string define_block() const;
+    // source with define_block inserted after its #version line
+    std::string apply(const std::string& source) const;
+    // Short human-readable form for logs, e.g. "MAX_BOUNCES=4 SCENE_SPHERES=true"
+    std::string name() const;
+
+    bool operator==(const ShaderVariant& other) const { return defines == other.defines; }
+    bool operator!=(const ShaderVariant& other) const { return defines != other.defines; }
+
+private:
+    std::vector<std::pair<std::string, std::string>> defines;
+};
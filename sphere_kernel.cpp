@@ -0,0 +1,192 @@
+#include "sphere_kernel.h"
+
+#include <cmath>
+#include <limits>
+#include "cpu_features.h"
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+void build_sphere_soa(const Scene& scene, const std::vector<uint32_t>& order, SphereSoA& soa)
+{
+    size_t slots = order.size() + sphereSoaPadding;
+    soa.centerX.assign(slots, 0.0f);
+    soa.centerY.assign(slots, 0.0f);
+    soa.centerZ.assign(slots, 0.0f);
+    soa.radiusSq.assign(slots, -std::numeric_limits<float>::infinity());
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        if (order[k] < scene.spheres.size())
+        {
+            const Sphere& sphere = scene.spheres[order[k]];
+            soa.centerX[k] = sphere.center.x;
+            soa.centerY[k] = sphere.center.y;
+            soa.centerZ[k] = sphere.center.z;
+            soa.radiusSq[k] = sphere.radius * sphere.radius;
+        }
+    }
+}
+
+// With |rd| = 1 the quadratic's a term is 1 and the factors of 2 cancel:
+// t = -b - sqrt(b^2 - c) for b = dot(oc, rd), c = dot(oc, oc) - r^2
+static int nearest_sphere_scalar(const SphereSoA& soa, uint32_t first, uint32_t count, const Vec3& ro, const Vec3& rd, float& tHit)
+{
+    int nearest = -1;
+    for (uint32_t k = first; k < first + count; k++)
+    {
+        float ocX = ro.x - soa.centerX[k];
+        float ocY = ro.y - soa.centerY[k];
+        float ocZ = ro.z - soa.centerZ[k];
+        float b = ocX * rd.x + ocY * rd.y + ocZ * rd.z;
+        float c = ocX * ocX + ocY * ocY + ocZ * ocZ - soa.radiusSq[k];
+        float discriminant = b * b - c;
+        if (discriminant < 0.0f)
+            continue;
+        float t = -b - std::sqrt(discriminant);
+        if (t > 0.0f && t < tHit)
+        {
+            tHit = t;
+            nearest = static_cast<int>(k);
+        }
+    }
+    return nearest;
+}
+
+#if CPU_X86
+CPU_TARGET("avx2,fma")
+static int nearest_sphere_avx2(const SphereSoA& soa, uint32_t first, uint32_t count, const Vec3& ro, const Vec3& rd, float& tHit)
+{
+    const __m256 roX = _mm256_set1_ps(ro.x), roY = _mm256_set1_ps(ro.y), roZ = _mm256_set1_ps(ro.z);
+    const __m256 rdX = _mm256_set1_ps(rd.x), rdY = _mm256_set1_ps(rd.y), rdZ = _mm256_set1_ps(rd.z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 bestT = _mm256_set1_ps(tHit);
+    __m256i bestSlot = _mm256_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 8)
+    {
+        uint32_t k = first + i;
+        __m256 ocX = _mm256_sub_ps(roX, _mm256_loadu_ps(&soa.centerX[k]));
+        __m256 ocY = _mm256_sub_ps(roY, _mm256_loadu_ps(&soa.centerY[k]));
+        __m256 ocZ = _mm256_sub_ps(roZ, _mm256_loadu_ps(&soa.centerZ[k]));
+        __m256 b = _mm256_fmadd_ps(ocX, rdX, _mm256_fmadd_ps(ocY, rdY, _mm256_mul_ps(ocZ, rdZ)));
+        __m256 c = _mm256_fmadd_ps(ocX, ocX, _mm256_fmadd_ps(ocY, ocY, _mm256_fmsub_ps(ocZ, ocZ, _mm256_loadu_ps(&soa.radiusSq[k]))));
+        __m256 discriminant = _mm256_fmsub_ps(b, b, c);
+        __m256 t = _mm256_sub_ps(_mm256_sub_ps(zero, b), _mm256_sqrt_ps(discriminant));
+
+        // Lanes past count belong to the next range
+        __m256i inRange = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count - i)), laneOffsets);
+        __m256 closer = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+                                      _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+        closer = _mm256_and_ps(closer, _mm256_castsi256_ps(inRange));
+        bestT = _mm256_blendv_ps(bestT, t, closer);
+        bestSlot = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestSlot),
+            _mm256_castsi256_ps(_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(k)), laneOffsets)), closer));
+    }
+
+    alignas(32) float laneT[8];
+    alignas(32) int laneSlot[8];
+    _mm256_store_ps(laneT, bestT);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(laneSlot), bestSlot);
+    int nearest = -1;
+    for (int lane = 0; lane < 8; lane++)
+    {
+        if (laneSlot[lane] >= 0 && laneT[lane] < tHit)
+        {
+            tHit = laneT[lane];
+            nearest = laneSlot[lane];
+        }
+    }
+    return nearest;
+}
+
+CPU_TARGET("avx512f")
+static int nearest_sphere_avx512(const SphereSoA& soa, uint32_t first, uint32_t count, const Vec3& ro, const Vec3& rd, float& tHit)
+{
+    const __m512 roX = _mm512_set1_ps(ro.x), roY = _mm512_set1_ps(ro.y), roZ = _mm512_set1_ps(ro.z);
+    const __m512 rdX = _mm512_set1_ps(rd.x), rdY = _mm512_set1_ps(rd.y), rdZ = _mm512_set1_ps(rd.z);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i laneOffsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m512 bestT = _mm512_set1_ps(tHit);
+    __m512i bestSlot = _mm512_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 16)
+    {
+        uint32_t k = first + i;
+        __m512 ocX = _mm512_sub_ps(roX, _mm512_loadu_ps(&soa.centerX[k]));
+        __m512 ocY = _mm512_sub_ps(roY, _mm512_loadu_ps(&soa.centerY[k]));
+        __m512 ocZ = _mm512_sub_ps(roZ, _mm512_loadu_ps(&soa.centerZ[k]));
+        __m512 b = _mm512_fmadd_ps(ocX, rdX, _mm512_fmadd_ps(ocY, rdY, _mm512_mul_ps(ocZ, rdZ)));
+        __m512 c = _mm512_fmadd_ps(ocX, ocX, _mm512_fmadd_ps(ocY, ocY, _mm512_fmsub_ps(ocZ, ocZ, _mm512_loadu_ps(&soa.radiusSq[k]))));
+        __m512 discriminant = _mm512_fmsub_ps(b, b, c);
+        // Lanes past count belong to the next range
+        __mmask16 inRange = count - i >= 16 ? 0xffff : static_cast<__mmask16>((1u << (count - i)) - 1);
+        __m512 t = _mm512_sub_ps(_mm512_sub_ps(zero, b), _mm512_maskz_sqrt_ps(inRange, discriminant));
+        __mmask16 closer = _mm512_mask_cmp_ps_mask(inRange, discriminant, zero, _CMP_GE_OQ);
+        closer = _mm512_mask_cmp_ps_mask(closer, t, zero, _CMP_GT_OQ);
+        closer = _mm512_mask_cmp_ps_mask(closer, t, bestT, _CMP_LT_OQ);
+        bestT = _mm512_mask_blend_ps(closer, bestT, t);
+        bestSlot = _mm512_mask_blend_epi32(closer, bestSlot, _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(k)), laneOffsets));
+    }
+
+    alignas(64) float laneT[16];
+    alignas(64) int laneSlot[16];
+    _mm512_store_ps(laneT, bestT);
+    _mm512_store_si512(laneSlot, bestSlot);
+    int nearest = -1;
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if (laneSlot[lane] >= 0 && laneT[lane] < tHit)
+        {
+            tHit = laneT[lane];
+            nearest = laneSlot[lane];
+        }
+    }
+    return nearest;
+}
+#endif
+
+bool sphere_kernel_supported(SphereKernel kernel)
+{
+    switch (kernel)
+    {
+    case SphereKernelAvx2: return cpu_supports(CpuFeatureAvx2);
+    case SphereKernelAvx512: return cpu_supports(CpuFeatureAvx512);
+    case SphereKernelScalar: break;
+    }
+    return true;
+}
+
+SphereKernel best_sphere_kernel()
+{
+    if (sphere_kernel_supported(SphereKernelAvx512))
+        return SphereKernelAvx512;
+    if (sphere_kernel_supported(SphereKernelAvx2))
+        return SphereKernelAvx2;
+    return SphereKernelScalar;
+}
+
+const char* sphere_kernel_name(SphereKernel kernel)
+{
+    switch (kernel)
+    {
+    case SphereKernelScalar: return "scalar";
+    case SphereKernelAvx2: return "avx2";
+    case SphereKernelAvx512: return "avx512";
+    }
+    return "unknown";
+}
+
+NearestSphereFn nearest_sphere_function(SphereKernel kernel)
+{
+#if CPU_X86
+    switch (kernel)
+    {
+    case SphereKernelAvx2: return nearest_sphere_avx2;
+    case SphereKernelAvx512: return nearest_sphere_avx512;
+    case SphereKernelScalar: break;
+    }
+#endif
+    return nearest_sphere_scalar;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "scene.h"
+
+// Spheres stored structure-of-arrays for the batch kernels. Slot k holds the
+// sphere at position k of some ordering (the CPU tracer uses BVH leaf order,
+// so a leaf's spheres are one contiguous range). Slots without a sphere have
+// radiusSq = -inf and never hit. The arrays carry sphereSoaPadding extra
+// never-hit slots so the kernels can always load full vectors.
+struct SphereSoA
+{
+    std::vector<float> centerX, centerY, centerZ, radiusSq;
+};
+
+const int sphereSoaPadding = 16;
+
+// Slot k gets scene.spheres[order[k]], or a never-hit slot when order[k] is
+// not a sphere id (see Bvh for the id layout).
+void build_sphere_soa(const Scene& scene, const std::vector<uint32_t>& order, SphereSoA& soa);
+
+// Nearest sphere in slots [first, first + count) that a unit-length ray hits
+// closer than tHit. Lowers tHit and returns the slot, or -1 when none is closer.
+typedef int (*NearestSphereFn)(const SphereSoA& soa, uint32_t first, uint32_t count, const Vec3& ro, const Vec3& rd, float& tHit);
+
+enum SphereKernel
+{
+    SphereKernelScalar,
+    SphereKernelAvx2,      // 8 spheres per instruction, with FMA
+    SphereKernelAvx512     // 16 spheres per instruction
+};
+
+// The widest kernel this CPU and OS support, checked at runtime; the SIMD
+// kernels are compiled for their target regardless of the build's flags.
+SphereKernel best_sphere_kernel();
+bool sphere_kernel_supported(SphereKernel kernel);
+const char* sphere_kernel_name(SphereKernel kernel);
+NearestSphereFn nearest_sphere_function(SphereKernel kernel);
@@ -0,0 +1,79 @@
+// Temporal accumulation shared by the fragment, compute and wavefront
+// backends. The history is the previous accumulation target: the running
+// average in rgb with the number of samples in it in a, the hit distance of
+// each pixel's last camera ray and, for adaptive sampling, the luminance
+// moment of adaptive.glsl. While the view stays still a
+// pixel averages its own history; after the camera moved, each pixel finds
+// where its new hit point was in the previous view and continues that
+// pixel's average instead, unless the previous ray there hit something at
+// another distance: then the point was hidden before and the history is
+// dropped. Needs raytrace.glsl.
+
+// historyMode in FrameBlock
+const int HISTORY_NONE = 0;         // start every pixel over
+const int HISTORY_SAME_PIXEL = 1;   // the view is unchanged
+const int HISTORY_REPROJECT = 2;    // the view moved since the history was traced
+
+// Samples a reprojected history counts for at most, so it keeps following
+// the motion instead of smearing the old view over the new one
+const float TEMPORAL_HISTORY_CAP = 16.0;
+// Relative difference in hit distance beyond which history is rejected
+const float DISOCCLUSION_TOLERANCE = 0.02;
+
+layout(binding = 0) uniform sampler2D accumulation;
+layout(binding = 1) uniform sampler2D accumulationDepth;
+layout(binding = 2) uniform sampler2D accumulationMoments;
+
+// Rec. 709, as luminance() in adaptive.h
+float luminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Pixel of the previous view that saw the hit at depth along rayDir, false if
+// it was off screen or hidden there. A miss is followed as a direction, a
+// point infinitely far away, and only matches previous misses.
+bool reprojectPixel(vec3 rayDir, float depth, out ivec2 source)
+{
+    source = ivec2(0);
+    bool miss = depth >= NO_HIT;
+    vec3 toPoint = miss ? rayDir : cameraPos.xyz + rayDir * depth - previousCameraPos.xyz;
+    float z = dot(toPoint, previousCameraForward.xyz);
+    if (z <= 0.0)
+        return false;
+
+    // The inverse of cameraRayDirection for the previous camera
+    vec2 uv = vec2(dot(toPoint, previousCameraRight.xyz) / dot(previousCameraRight.xyz, previousCameraRight.xyz),
+                   dot(toPoint, previousCameraUp.xyz) / dot(previousCameraUp.xyz, previousCameraUp.xyz)) / z;
+    vec2 pixelCoord = (uv * 0.5 + 0.5) / pixelSize;
+    if (any(lessThan(pixelCoord, vec2(0.0))) || pixelCoord.x >= float(windowWidth) || pixelCoord.y >= float(windowHeight))
+        return false;
+    source = ivec2(pixelCoord);
+
+    float previousDepth = texelFetch(accumulationDepth, source, 0).r;
+    if (miss || previousDepth >= NO_HIT)
+        return miss && previousDepth >= NO_HIT;
+    float distance = length(toPoint);
+    return abs(previousDepth - distance) <= DISOCCLUSION_TOLERANCE * distance;
+}
+
+// The pixel's new average once color, the sample whose camera ray went along
+// rayDir and hit at depth, is added to its history. moment receives the
+// history's sum of squared luminance deviations with the sample added, as in
+// Welford's algorithm.
+vec4 accumulateSample(ivec2 pixel, vec3 rayDir, vec3 color, float depth, out float moment)
+{
+    moment = 0.0;
+    ivec2 source = pixel;
+    if (historyMode == HISTORY_NONE || (historyMode == HISTORY_REPROJECT && !reprojectPixel(rayDir, depth, source)))
+        return vec4(color, 1.0);
+
+    vec4 previous = texelFetch(accumulation, source, 0);
+    float samples = historyMode == HISTORY_REPROJECT ? min(previous.a, TEMPORAL_HISTORY_CAP) : previous.a;
+    vec4 average = vec4(mix(previous.rgb, color, 1.0 / (samples + 1.0)), samples + 1.0);
+    // A capped history keeps its variance, so its sum shrinks with the count
+    float sampleLuminance = luminance(color);
+    moment = texelFetch(accumulationMoments, source, 0).r * (samples / previous.a)
+           + (sampleLuminance - luminance(previous.rgb)) * (sampleLuminance - luminance(average.rgb));
+    return average;
+}
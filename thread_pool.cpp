@@ -0,0 +1,95 @@
+#include "thread_pool.h"
+
+static thread_local bool insidePool = false;
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+    for (unsigned i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)>& body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+    if (workers.empty() || insidePool || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            body(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &body;
+        jobCount = count;
+        nextIndex = 0;
+        activeWorkers = static_cast<unsigned>(workers.size());
+        generation++;
+    }
+    wake.notify_all();
+
+    run_indices();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return activeWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::worker_loop()
+{
+    unsigned seenGeneration = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+        if (stopping)
+        {
+            return;
+        }
+        seenGeneration = generation;
+        lock.unlock();
+
+        run_indices();
+
+        lock.lock();
+        if (--activeWorkers == 0)
+        {
+            done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_indices()
+{
+    insidePool = true;
+    int index;
+    while ((index = nextIndex.fetch_add(1)) < jobCount)
+    {
+        (*job)(index);
+    }
+    insidePool = false;
+}
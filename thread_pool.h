@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for the CPU backend. parallel_for hands out indices
+// dynamically so uneven work (tiles that hit geometry vs. tiles that miss)
+// balances itself. The calling thread takes part in the work, and a nested
+// parallel_for from inside a job runs inline instead of deadlocking.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that execute jobs, including the caller.
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    void parallel_for(int count, const std::function<void(int)>& body);
+
+private:
+    void worker_loop();
+    void run_indices();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* job = nullptr;
+    int jobCount = 0;
+    std::atomic<int> nextIndex{0};
+    unsigned activeWorkers = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "vec3.h"
+
+// Row-major 3x4 affine transform, the layout instances are uploaded in: each
+// row holds one row of the linear part followed by its translation component.
+struct Transform
+{
+    float m[3][4] = {
+        { 1.0f, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f, 0.0f }
+    };
+
+    Vec3 point(const Vec3& p) const
+    {
+        return Vec3(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                    m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                    m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+
+    // Directions ignore the translation; they are not renormalized.
+    Vec3 vector(const Vec3& v) const
+    {
+        return Vec3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                    m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                    m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+};
+
+// a applied after b
+inline Transform operator*(const Transform& a, const Transform& b)
+{
+    Transform r;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r.m[row][col] = a.m[row][0] * b.m[0][col] + a.m[row][1] * b.m[1][col] + a.m[row][2] * b.m[2][col];
+        }
+        r.m[row][3] += a.m[row][3];
+    }
+    return r;
+}
+
+// Of the linear part; 0 for a transform that flattens space and has no inverse
+inline float determinant(const Transform& t)
+{
+    const float (&m)[3][4] = t.m;
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) + m[0][1] * (m[1][2] * m[2][0] - m[1][0] * m[2][2])
+         + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+// Inverse of an invertible affine transform: the 3x3 inverse from cofactors,
+// then the translation carried through it. Check determinant() first.
+inline Transform inverse(const Transform& t)
+{
+    const float (&m)[3][4] = t.m;
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float invDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+    Transform r;
+    r.m[0][0] = c00 * invDet;
+    r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+    r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+    r.m[1][0] = c01 * invDet;
+    r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+    r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+    r.m[2][0] = c02 * invDet;
+    r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+    r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+    Vec3 translation = r.vector(Vec3(m[0][3], m[1][3], m[2][3]));
+    r.m[0][3] = -translation.x;
+    r.m[1][3] = -translation.y;
+    r.m[2][3] = -translation.z;
+    return r;
+}
+
+inline Transform translation(const Vec3& offset)
+{
+    Transform t;
+    t.m[0][3] = offset.x;
+    t.m[1][3] = offset.y;
+    t.m[2][3] = offset.z;
+    return t;
+}
+
+inline Transform scaling(float s)
+{
+    Transform t;
+    t.m[0][0] = s;
+    t.m[1][1] = s;
+    t.m[2][2] = s;
+    return t;
+}
+
+// Same handedness as R_x and R_y in the fragment shader
+inline Transform rotation_x(float angle)
+{
+    Transform t;
+    t.m[1][1] = std::cos(angle);
+    t.m[1][2] = std::sin(angle);
+    t.m[2][1] = -std::sin(angle);
+    t.m[2][2] = std::cos(angle);
+    return t;
+}
+
+inline Transform rotation_y(float angle)
+{
+    Transform t;
+    t.m[0][0] = std::cos(angle);
+    t.m[0][2] = -std::sin(angle);
+    t.m[2][0] = std::sin(angle);
+    t.m[2][2] = std::cos(angle);
+    return t;
+}
@@ -0,0 +1,227 @@
+// The watertight test only closes the gaps between triangles if both
+// triangles of an edge round its edge function the same way, so nothing in
+// this file may be fused into multiply-adds
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "triangle_kernel.h"
+
+#include <cmath>
+#include <limits>
+#include <utility>
+#include "cpu_features.h"
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+// SSE2 is part of x86-64 and needs no runtime check
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLE_SSE 1
+#endif
+
+void build_triangle_soa(const std::vector<Triangle>& triangles, const std::vector<uint32_t>& order, uint32_t idBase,
+                        TriangleTest test, TriangleSoA& soa)
+{
+    size_t slots = order.size() + triangleSoaPadding;
+    soa.test = test;
+    for (int corner = 0; corner < 3; corner++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            soa.p[corner][axis].assign(slots, std::numeric_limits<float>::quiet_NaN());
+        }
+    }
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        if (order[k] < idBase || order[k] - idBase >= triangles.size())
+            continue;
+        const Triangle& triangle = triangles[order[k] - idBase];
+        Vec3 corners[3] = { triangle.v0, triangle.v1, triangle.v2 };
+        if (test == TriangleTestMollerTrumbore)
+        {
+            corners[1] = triangle.v1 - triangle.v0;
+            corners[2] = triangle.v2 - triangle.v0;
+        }
+        for (int corner = 0; corner < 3; corner++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                soa.p[corner][axis][k] = corners[corner][axis];
+            }
+        }
+    }
+}
+
+TriangleRay make_triangle_ray(const Vec3& ro, const Vec3& rd)
+{
+    TriangleRay ray;
+    ray.origin = ro;
+    ray.direction = rd;
+    Vec3 absDir(std::fabs(rd.x), std::fabs(rd.y), std::fabs(rd.z));
+    ray.kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+    ray.kx = (ray.kz + 1) % 3;
+    ray.ky = (ray.kx + 1) % 3;
+    // Keep the winding of the projected triangle whichever way the ray points
+    if (rd[ray.kz] < 0.0f)
+    {
+        std::swap(ray.kx, ray.ky);
+    }
+    ray.shearX = rd[ray.kx] / rd[ray.kz];
+    ray.shearY = rd[ray.ky] / rd[ray.kz];
+    ray.shearZ = 1.0f / rd[ray.kz];
+    return ray;
+}
+
+// Vertices are moved to the ray origin and sheared so the ray runs along +z;
+// the hit is then a 2D point-in-triangle test at the origin with signed edge
+// functions u, v, w. A ray exactly through an edge may report both of its
+// triangles, which is harmless for the closest hit.
+bool intersect_triangle_watertight(const TriangleRay& ray, const Vec3& v0, const Vec3& v1, const Vec3& v2, float& t)
+{
+    Vec3 a = v0 - ray.origin;
+    Vec3 b = v1 - ray.origin;
+    Vec3 c = v2 - ray.origin;
+    float ax = a[ray.kx] - ray.shearX * a[ray.kz];
+    float ay = a[ray.ky] - ray.shearY * a[ray.kz];
+    float bx = b[ray.kx] - ray.shearX * b[ray.kz];
+    float by = b[ray.ky] - ray.shearY * b[ray.kz];
+    float cx = c[ray.kx] - ray.shearX * c[ray.kz];
+    float cy = c[ray.ky] - ray.shearY * c[ray.kz];
+
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+        return false;
+
+    float det = u + v + w;
+    if (det == 0.0f)
+        return false;
+
+    t = ray.shearZ * (u * a[ray.kz] + v * b[ray.kz] + w * c[ray.kz]) / det;
+    return t > 0.0f;
+}
+
+#if !TRIANGLE_SSE
+static bool intersect_triangle_edges(const TriangleRay& ray, const Vec3& v0, const Vec3& edge1, const Vec3& edge2, float& t)
+{
+    Vec3 p = cross(ray.direction, edge2);
+    float det = dot(edge1, p);
+    if (!(std::fabs(det) >= 1e-8f))
+        return false;
+
+    float invDet = 1.0f / det;
+    Vec3 s = ray.origin - v0;
+    float u = dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    Vec3 q = cross(s, edge1);
+    float v = dot(ray.direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    t = dot(edge2, q) * invDet;
+    return t > 0.0f;
+}
+#endif
+
+#if TRIANGLE_SSE
+namespace sse2
+{
+typedef __m128 Lanes;
+const int laneCount = 4;
+static inline Lanes lanes_set(float v) { return _mm_set1_ps(v); }
+static inline Lanes lanes_load(const float* p) { return _mm_loadu_ps(p); }
+static inline void lanes_store(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+static inline Lanes lanes_add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanes_div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+static inline Lanes lanes_and(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+static inline Lanes lanes_or(Lanes a, Lanes b) { return _mm_or_ps(a, b); }
+static inline Lanes lanes_andnot(Lanes a, Lanes b) { return _mm_andnot_ps(a, b); }
+static inline Lanes lanes_lt(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+static inline Lanes lanes_le(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+static inline Lanes lanes_neq(Lanes a, Lanes b) { return _mm_andnot_ps(_mm_cmpunord_ps(a, b), _mm_cmpneq_ps(a, b)); }
+static inline unsigned lanes_mask(Lanes a) { return static_cast<unsigned>(_mm_movemask_ps(a)); }
+
+#define LANES_TARGET
+#include "triangle_lanes.inl"
+#undef LANES_TARGET
+}
+#endif
+
+// Compiled for AVX2 whatever the build's flags; nearest_triangle only calls
+// it when the CPU has it
+#if CPU_X86
+namespace avx2
+{
+typedef __m256 Lanes;
+const int laneCount = 8;
+CPU_TARGET("avx2") static inline Lanes lanes_set(float v) { return _mm256_set1_ps(v); }
+CPU_TARGET("avx2") static inline Lanes lanes_load(const float* p) { return _mm256_loadu_ps(p); }
+CPU_TARGET("avx2") static inline void lanes_store(float* p, Lanes a) { _mm256_storeu_ps(p, a); }
+CPU_TARGET("avx2") static inline Lanes lanes_add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_and(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_or(Lanes a, Lanes b) { return _mm256_or_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_andnot(Lanes a, Lanes b) { return _mm256_andnot_ps(a, b); }
+CPU_TARGET("avx2") static inline Lanes lanes_lt(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+CPU_TARGET("avx2") static inline Lanes lanes_le(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+CPU_TARGET("avx2") static inline Lanes lanes_neq(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+CPU_TARGET("avx2") static inline unsigned lanes_mask(Lanes a) { return static_cast<unsigned>(_mm256_movemask_ps(a)); }
+
+#define LANES_TARGET CPU_TARGET("avx2")
+#include "triangle_lanes.inl"
+#undef LANES_TARGET
+}
+#endif
+
+int nearest_triangle(const TriangleSoA& soa, uint32_t first, uint32_t count, const TriangleRay& ray, float& tHit)
+{
+#if CPU_X86
+    // Checked once, like the sphere kernels
+    static const bool useAvx2 = cpu_supports(CpuFeatureAvx2);
+    if (useAvx2)
+        return avx2::nearest_triangle_lanes(soa, first, count, ray, tHit);
+#endif
+#if TRIANGLE_SSE
+    return sse2::nearest_triangle_lanes(soa, first, count, ray, tHit);
+#else
+    int nearest = -1;
+    for (uint32_t k = first; k < first + count; k++)
+    {
+        Vec3 corners[3];
+        for (int corner = 0; corner < 3; corner++)
+        {
+            corners[corner] = Vec3(soa.p[corner][0][k], soa.p[corner][1][k], soa.p[corner][2][k]);
+        }
+        float t;
+        bool hit = soa.test == TriangleTestWatertight ? intersect_triangle_watertight(ray, corners[0], corners[1], corners[2], t)
+                                                      : intersect_triangle_edges(ray, corners[0], corners[1], corners[2], t);
+        if (hit && t < tHit)
+        {
+            tHit = t;
+            nearest = static_cast<int>(k);
+        }
+    }
+    return nearest;
+#endif
+}
+
+const char* triangle_test_name(TriangleTest test)
+{
+    switch (test)
+    {
+    case TriangleTestMollerTrumbore: return "moller-trumbore";
+    case TriangleTestWatertight: return "watertight";
+    }
+    return "unknown";
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "scene.h"
+
+enum TriangleTest
+{
+    TriangleTestMollerTrumbore,     // v0 and precomputed edges; the fastest
+    TriangleTestWatertight          // Woop, Benthin and Wald; no cracks along shared edges
+};
+
+// Triangles stored structure-of-arrays for the batch kernel, in BVH leaf
+// order like SphereSoA so a leaf's triangles are one contiguous range.
+// p[0] is v0 for both tests. Moller-Trumbore keeps the precomputed edges
+// v1 - v0 and v2 - v0 in p[1] and p[2]; the watertight test must see the
+// same vertex values from every triangle sharing an edge, so there they hold
+// v1 and v2. Each is indexed by axis. Slots without a triangle hold NaNs and
+// never hit; triangleSoaPadding extra ones let the kernel load full vectors.
+struct TriangleSoA
+{
+    TriangleTest test = TriangleTestMollerTrumbore;
+    std::vector<float> p[3][3];
+};
+
+const int triangleSoaPadding = 8;
+
+// Slot k gets triangles[order[k] - idBase], or a never-hit slot when that
+// falls outside triangles (top-level orders mix in other primitive ids).
+void build_triangle_soa(const std::vector<Triangle>& triangles, const std::vector<uint32_t>& order, uint32_t idBase,
+                        TriangleTest test, TriangleSoA& soa);
+
+// Per-ray setup for the watertight test, done once per traversal: kz is the
+// dominant direction axis, and the shear maps the direction onto +z.
+struct TriangleRay
+{
+    Vec3 origin;
+    Vec3 direction;
+    int kx, ky, kz;
+    float shearX, shearY, shearZ;
+};
+
+TriangleRay make_triangle_ray(const Vec3& ro, const Vec3& rd);
+
+bool intersect_triangle_watertight(const TriangleRay& ray, const Vec3& v0, const Vec3& v1, const Vec3& v2, float& t);
+
+// Nearest triangle in slots [first, first + count) hit closer than tHit
+// with soa's test, 8 at a time with AVX2 when the CPU has it and otherwise
+// 4 with SSE2. Lowers tHit and returns the slot, or -1 when none is closer.
+int nearest_triangle(const TriangleSoA& soa, uint32_t first, uint32_t count, const TriangleRay& ray, float& tHit);
+
+const char* triangle_test_name(TriangleTest test);
@@ -0,0 +1,115 @@
+// Triangle kernels over laneCount triangles at a time, written once against
+// the Lanes type, lanes_ helpers and LANES_TARGET of whatever includes this.
+// Only for triangle_kernel.cpp, which includes it once per instruction set,
+// each time in its own namespace; hence no include guard.
+
+LANES_TARGET static inline Lanes lanes_dot(Lanes ax, Lanes ay, Lanes az, Lanes bx, Lanes by, Lanes bz)
+{
+    return lanes_add(lanes_add(lanes_mul(ax, bx), lanes_mul(ay, by)), lanes_mul(az, bz));
+}
+
+// Lowers tHit to the closest hit lane of slots k onwards. Hits are rare next
+// to misses, so the lanes are only walked when there is one.
+LANES_TARGET static int closest_lane(Lanes hit, Lanes t, uint32_t k, uint32_t remaining, float& tHit, int nearest)
+{
+    unsigned bits = lanes_mask(hit);
+    if (remaining < laneCount)
+    {
+        // Lanes past count belong to the next range
+        bits &= (1u << remaining) - 1;
+    }
+    if (!bits)
+        return nearest;
+    float laneT[laneCount];
+    lanes_store(laneT, t);
+    for (int lane = 0; lane < laneCount; lane++)
+    {
+        if ((bits & (1u << lane)) && laneT[lane] < tHit)
+        {
+            tHit = laneT[lane];
+            nearest = static_cast<int>(k) + lane;
+        }
+    }
+    return nearest;
+}
+
+LANES_TARGET static int nearest_triangle_edges(const TriangleSoA& soa, uint32_t first, uint32_t count, const TriangleRay& ray, float& tHit)
+{
+    const Lanes dX = lanes_set(ray.direction.x), dY = lanes_set(ray.direction.y), dZ = lanes_set(ray.direction.z);
+    const Lanes oX = lanes_set(ray.origin.x), oY = lanes_set(ray.origin.y), oZ = lanes_set(ray.origin.z);
+    const Lanes zero = lanes_set(0.0f), one = lanes_set(1.0f);
+    const Lanes minDet = lanes_set(1e-8f), signBit = lanes_set(-0.0f);
+    int nearest = -1;
+    for (uint32_t i = 0; i < count; i += laneCount)
+    {
+        uint32_t k = first + i;
+        Lanes e1X = lanes_load(&soa.p[1][0][k]), e1Y = lanes_load(&soa.p[1][1][k]), e1Z = lanes_load(&soa.p[1][2][k]);
+        Lanes e2X = lanes_load(&soa.p[2][0][k]), e2Y = lanes_load(&soa.p[2][1][k]), e2Z = lanes_load(&soa.p[2][2][k]);
+        // p = cross(rd, edge2)
+        Lanes pX = lanes_sub(lanes_mul(dY, e2Z), lanes_mul(dZ, e2Y));
+        Lanes pY = lanes_sub(lanes_mul(dZ, e2X), lanes_mul(dX, e2Z));
+        Lanes pZ = lanes_sub(lanes_mul(dX, e2Y), lanes_mul(dY, e2X));
+        Lanes det = lanes_dot(e1X, e1Y, e1Z, pX, pY, pZ);
+        Lanes invDet = lanes_div(one, det);
+
+        Lanes sX = lanes_sub(oX, lanes_load(&soa.p[0][0][k]));
+        Lanes sY = lanes_sub(oY, lanes_load(&soa.p[0][1][k]));
+        Lanes sZ = lanes_sub(oZ, lanes_load(&soa.p[0][2][k]));
+        Lanes u = lanes_mul(lanes_dot(sX, sY, sZ, pX, pY, pZ), invDet);
+        // q = cross(s, edge1)
+        Lanes qX = lanes_sub(lanes_mul(sY, e1Z), lanes_mul(sZ, e1Y));
+        Lanes qY = lanes_sub(lanes_mul(sZ, e1X), lanes_mul(sX, e1Z));
+        Lanes qZ = lanes_sub(lanes_mul(sX, e1Y), lanes_mul(sY, e1X));
+        Lanes v = lanes_mul(lanes_dot(dX, dY, dZ, qX, qY, qZ), invDet);
+        Lanes t = lanes_mul(lanes_dot(e2X, e2Y, e2Z, qX, qY, qZ), invDet);
+
+        Lanes hit = lanes_le(minDet, lanes_andnot(signBit, det));
+        hit = lanes_and(hit, lanes_and(lanes_le(zero, u), lanes_le(u, one)));
+        hit = lanes_and(hit, lanes_and(lanes_le(zero, v), lanes_le(lanes_add(u, v), one)));
+        hit = lanes_and(hit, lanes_and(lanes_lt(zero, t), lanes_lt(t, lanes_set(tHit))));
+        nearest = closest_lane(hit, t, k, count - i, tHit, nearest);
+    }
+    return nearest;
+}
+
+LANES_TARGET static int nearest_triangle_watertight(const TriangleSoA& soa, uint32_t first, uint32_t count, const TriangleRay& ray, float& tHit)
+{
+    const int kx = ray.kx, ky = ray.ky, kz = ray.kz;
+    const Lanes oX = lanes_set(ray.origin[kx]), oY = lanes_set(ray.origin[ky]), oZ = lanes_set(ray.origin[kz]);
+    const Lanes shearX = lanes_set(ray.shearX), shearY = lanes_set(ray.shearY), shearZ = lanes_set(ray.shearZ);
+    const Lanes zero = lanes_set(0.0f);
+    int nearest = -1;
+    for (uint32_t i = 0; i < count; i += laneCount)
+    {
+        uint32_t k = first + i;
+        Lanes az = lanes_sub(lanes_load(&soa.p[0][kz][k]), oZ);
+        Lanes bz = lanes_sub(lanes_load(&soa.p[1][kz][k]), oZ);
+        Lanes cz = lanes_sub(lanes_load(&soa.p[2][kz][k]), oZ);
+        Lanes ax = lanes_sub(lanes_sub(lanes_load(&soa.p[0][kx][k]), oX), lanes_mul(shearX, az));
+        Lanes ay = lanes_sub(lanes_sub(lanes_load(&soa.p[0][ky][k]), oY), lanes_mul(shearY, az));
+        Lanes bx = lanes_sub(lanes_sub(lanes_load(&soa.p[1][kx][k]), oX), lanes_mul(shearX, bz));
+        Lanes by = lanes_sub(lanes_sub(lanes_load(&soa.p[1][ky][k]), oY), lanes_mul(shearY, bz));
+        Lanes cx = lanes_sub(lanes_sub(lanes_load(&soa.p[2][kx][k]), oX), lanes_mul(shearX, cz));
+        Lanes cy = lanes_sub(lanes_sub(lanes_load(&soa.p[2][ky][k]), oY), lanes_mul(shearY, cz));
+
+        Lanes u = lanes_sub(lanes_mul(cx, by), lanes_mul(cy, bx));
+        Lanes v = lanes_sub(lanes_mul(ax, cy), lanes_mul(ay, cx));
+        Lanes w = lanes_sub(lanes_mul(bx, ay), lanes_mul(by, ax));
+        Lanes negative = lanes_or(lanes_or(lanes_lt(u, zero), lanes_lt(v, zero)), lanes_lt(w, zero));
+        Lanes positive = lanes_or(lanes_or(lanes_lt(zero, u), lanes_lt(zero, v)), lanes_lt(zero, w));
+        Lanes det = lanes_add(lanes_add(u, v), w);
+        Lanes t = lanes_div(lanes_mul(shearZ, lanes_add(lanes_add(lanes_mul(u, az), lanes_mul(v, bz)), lanes_mul(w, cz))), det);
+
+        Lanes hit = lanes_andnot(lanes_and(negative, positive), lanes_neq(det, zero));
+        hit = lanes_and(hit, lanes_and(lanes_lt(zero, t), lanes_lt(t, lanes_set(tHit))));
+        nearest = closest_lane(hit, t, k, count - i, tHit, nearest);
+    }
+    return nearest;
+}
+
+LANES_TARGET static int nearest_triangle_lanes(const TriangleSoA& soa, uint32_t first, uint32_t count, const TriangleRay& ray, float& tHit)
+{
+    if (soa.test == TriangleTestWatertight)
+        return nearest_triangle_watertight(soa, first, count, ray, tHit);
+    return nearest_triangle_edges(soa, first, count, ray, tHit);
+}
@@ -0,0 +1,274 @@
+#include "wavefront.h"
+
+#include <chrono>
+
+// The material model, as in wavefront.glsl
+const float PI = 3.1415926535897932384f;
+const float rayEpsilon = 1e-3f;
+const Vec3 sunRadiance(2.6f, 2.5f, 2.3f);
+const Vec3 skyHorizon(0.75f, 0.8f, 0.85f);
+const Vec3 skyZenith(0.3f, 0.45f, 0.75f);
+
+enum Surface
+{
+    SurfaceSphere,
+    SurfaceTriangle,
+    SurfaceInstance
+};
+
+static Vec3 sun_direction()
+{
+    return normalize(Vec3(0.4f, 1.0f, 0.25f));
+}
+
+static uint32_t pcg_hash(uint32_t v)
+{
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+static float random(uint32_t& state)
+{
+    state = pcg_hash(state);
+    return float(state >> 8u) * (1.0f / 16777216.0f);
+}
+
+static int surface_of(const Scene& scene, uint32_t prim)
+{
+    if (prim < scene.spheres.size())
+        return SurfaceSphere;
+    return prim < scene.spheres.size() + scene.triangles.size() ? SurfaceTriangle : SurfaceInstance;
+}
+
+static WavefrontMaterial surface_material(int surface)
+{
+    return surface == SurfaceInstance ? WavefrontMaterialMirror : WavefrontMaterialDiffuse;
+}
+
+static Vec3 surface_albedo(int surface)
+{
+    if (surface == SurfaceSphere)
+        return Vec3(0.9f, 0.2f, 0.2f);
+    return surface == SurfaceTriangle ? Vec3(0.75f, 0.75f, 0.75f) : Vec3(0.9f, 0.9f, 0.85f);
+}
+
+static Vec3 sky_radiance(const Vec3& direction)
+{
+    float f = std::max(direction.y, 0.0f);
+    return skyHorizon * (1.0f - f) + skyZenith * f;
+}
+
+static Vec3 cosine_sample_hemisphere(const Vec3& n, float u1, float u2)
+{
+    float s = n.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (s + n.z);
+    float b = n.x * n.y * a;
+    Vec3 tangent(1.0f + s * n.x * n.x * a, s * b, -s * n.x);
+    Vec3 bitangent(b, s + n.y * n.y * a, -n.y);
+    float r = std::sqrt(u1);
+    float phi = 2.0f * PI * u2;
+    return normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - u1)));
+}
+
+static Vec3 reflect(const Vec3& incoming, const Vec3& normal)
+{
+    return incoming - normal * (2.0f * dot(normal, incoming));
+}
+
+// One queue dispatch: body(path) for every queued path, a workgroup's worth per job
+template <typename Body>
+static void run_queue(ThreadPool& pool, const std::vector<uint32_t>& items, uint32_t length, Body&& body)
+{
+    int groups = static_cast<int>((length + wavefrontGroupSize - 1) / wavefrontGroupSize);
+    pool.parallel_for(groups, [&](int group)
+    {
+        uint32_t first = static_cast<uint32_t>(group) * wavefrontGroupSize;
+        uint32_t last = std::min(first + wavefrontGroupSize, length);
+        for (uint32_t i = first; i < last; i++)
+        {
+            body(items[i]);
+        }
+    });
+}
+
+WavefrontStats CpuWavefront::render_sample(const CpuFrameParams& params, const Scene& scene, const CpuSceneBvh& cpuBvh, ThreadPool& pool)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    size_t pathCount = static_cast<size_t>(params.width) * params.height;
+    if (params.width != width || params.height != height)
+    {
+        width = params.width;
+        height = params.height;
+        paths.resize(pathCount);
+        for (Queue& queue : queues)
+        {
+            queue.items.resize(pathCount);
+        }
+        average.assign(pathCount, Vec3());
+        moments.assign(pathCount, 0.0f);
+        sampleCount = 0;
+    }
+    bool adaptive = params.adaptiveError > 0.0f;
+    if (adaptive)
+    {
+        if (sampleCount == 0)
+        {
+            scheduler.reset(width, height);
+        }
+        scheduler.schedule(average, moments, params.adaptiveError, pool);
+    }
+    for (Queue& queue : queues)
+    {
+        queue.length = 0;
+    }
+
+    WavefrontStats stats = {};
+    const Vec3 sunDirection = sun_direction();
+    int rayQueue = 0;
+
+    // Generate
+    Camera camera = make_cpu_camera(params);
+    uint32_t sampleSeed = pcg_hash(static_cast<uint32_t>(sampleCount));
+    pool.parallel_for(params.height, [&](int y)
+    {
+        for (int x = 0; x < params.width; x++)
+        {
+            if (adaptive && !scheduler.sampled(x, y))
+                continue;
+            uint32_t index = static_cast<uint32_t>(y * params.width + x);
+            Path& path = paths[index];
+            path.origin = camera.position;
+            path.rng = pcg_hash(index + sampleSeed);
+            path.direction = primary_ray_direction(camera, x, y);
+            path.throughput = Vec3(1.0f, 1.0f, 1.0f);
+            path.radiance = Vec3();
+            queues[WavefrontQueueRays + rayQueue].push(index);
+        }
+    });
+
+    for (int bounce = 0; bounce < wavefrontMaxBounces; bounce++)
+    {
+        Queue& rays = queues[WavefrontQueueRays + rayQueue];
+        Queue& nextRays = queues[WavefrontQueueRays + 1 - rayQueue];
+        nextRays.length = 0;
+        for (int q = WavefrontQueueMaterials; q < WavefrontQueueCount; q++)
+        {
+            queues[q].length = 0;
+        }
+
+        // Extend
+        uint32_t rayCount = rays.length;
+        stats.extensionRays += rayCount;
+        run_queue(pool, rays.items, rayCount, [&](uint32_t index)
+        {
+            Path& path = paths[index];
+            SceneHit hit;
+            if (!trace_scene_hit(scene, cpuBvh, path.origin, path.direction, hit))
+            {
+                path.radiance += path.throughput * sky_radiance(path.direction);
+                return;
+            }
+            path.t = hit.t;
+            path.normal = hit.normal;
+            path.surface = surface_of(scene, hit.prim);
+            queues[WavefrontQueueMaterials + surface_material(path.surface)].push(index);
+        });
+
+        // Shade, one material at a time
+        for (int material = 0; material < WavefrontMaterialCount; material++)
+        {
+            Queue& hits = queues[WavefrontQueueMaterials + material];
+            uint32_t hitCount = hits.length;
+            stats.shaded[material] += hitCount;
+            run_queue(pool, hits.items, hitCount, [&](uint32_t index)
+            {
+                Path& path = paths[index];
+                Vec3 normal = dot(path.normal, path.direction) > 0.0f ? -path.normal : path.normal;
+                Vec3 position = path.origin + path.direction * path.t + normal * rayEpsilon;
+                Vec3 throughput = path.throughput * surface_albedo(path.surface);
+
+                Vec3 direction;
+                if (material == WavefrontMaterialDiffuse)
+                {
+                    // Lambert: albedo / PI, with the albedo already in throughput
+                    float cosSun = dot(normal, sunDirection);
+                    if (cosSun > 0.0f)
+                    {
+                        path.shadowOrigin = position;
+                        path.shadowContribution = throughput * sunRadiance * (cosSun / PI);
+                        queues[WavefrontQueueShadow].push(index);
+                    }
+                    float u1 = random(path.rng);
+                    float u2 = random(path.rng);
+                    direction = cosine_sample_hemisphere(normal, u1, u2);
+                }
+                else
+                {
+                    direction = reflect(path.direction, normal);
+                }
+
+                if (bounce + 1 >= wavefrontMaxBounces)
+                    return;
+                path.origin = position;
+                path.direction = direction;
+                path.throughput = throughput;
+                nextRays.push(index);
+            });
+        }
+
+        // Connect
+        Queue& shadows = queues[WavefrontQueueShadow];
+        uint32_t shadowCount = shadows.length;
+        stats.shadowRays += shadowCount;
+        run_queue(pool, shadows.items, shadowCount, [&](uint32_t index)
+        {
+            Path& path = paths[index];
+            float t;
+            if (!trace_scene(scene, cpuBvh, path.shadowOrigin, sunDirection, t))
+            {
+                path.radiance += path.shadowContribution;
+            }
+        });
+
+        rayQueue = 1 - rayQueue;
+    }
+
+    // Resolve, where pixels of stopped tiles keep their average
+    float weight = 1.0f / float(sampleCount + 1);
+    pool.parallel_for(params.height, [&](int y)
+    {
+        for (int x = 0; x < params.width; x++)
+        {
+            float pixelWeight = weight;
+            if (adaptive)
+            {
+                if (!scheduler.sampled(x, y))
+                    continue;
+                pixelWeight = 1.0f / float(scheduler.samples(x, y));
+            }
+            size_t i = static_cast<size_t>(y) * params.width + x;
+            float previousMean = luminance(average[i]);
+            average[i] = average[i] * (1.0f - pixelWeight) + paths[i].radiance * pixelWeight;
+            // Welford: the deviation from the old mean times the one from the new
+            float sample = luminance(paths[i].radiance);
+            moments[i] = pixelWeight == 1.0f ? 0.0f : moments[i] + (sample - previousMean) * (sample - luminance(average[i]));
+        }
+    });
+    sampleCount++;
+
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    return stats;
+}
+
+void CpuWavefront::resolve(std::vector<unsigned char>& rgb) const
+{
+    rgb.resize(average.size() * 3);
+    for (size_t i = 0; i < average.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            rgb[i * 3 + c] = static_cast<unsigned char>(std::clamp(average[i][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
@@ -0,0 +1,165 @@
+// Path state, ray queues and material model of the wavefront path tracer,
+// shared by its kernels. A sample runs wavefront_generate.comp once, then per
+// bounce wavefront_extend.comp, wavefront_shade.comp once per material and
+// wavefront_connect.comp, and finally wavefront_resolve.comp. The stages hand
+// paths on through queues of path indices in WavefrontBuffer; each append
+// bumps the queue's length and, every WAVEFRONT_GROUP_SIZE items, its indirect
+// dispatch size, so the next stage runs over exactly the queued paths.
+// CpuWavefront in wavefront.cpp mirrors all of this on the CPU.
+
+#include "raytrace.glsl"
+
+uniform int rayQueue;       // QUEUE_RAYS + rayQueue holds this bounce's rays, the other one the next bounce's
+uniform int bounce;
+uniform int shadeMaterial;  // the material wavefront_shade.comp runs for
+
+const int QUEUE_RAYS = 0;
+const int QUEUE_MATERIALS = 2;  // one queue per material, in material order
+const int QUEUE_SHADOW = 4;
+const int QUEUE_COUNT = 5;
+
+const int MATERIAL_DIFFUSE = 0;
+const int MATERIAL_MIRROR = 1;
+
+// Until scenes carry materials, the kind of primitive decides the surface
+const int SURFACE_SPHERE = 0;
+const int SURFACE_TRIANGLE = 1;
+const int SURFACE_INSTANCE = 2;
+
+// Defined by the C++ side from wavefrontMaxBounces, which its dispatch loop runs
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 4
+#endif
+const uint WAVEFRONT_GROUP_SIZE = 64u;  // local_size_x of the queue kernels
+const float RAY_EPSILON = 1e-3;
+
+const vec3 SUN_DIRECTION = normalize(vec3(0.4, 1.0, 0.25));
+const vec3 SUN_RADIANCE = vec3(2.6, 2.5, 2.3);
+const vec3 SKY_HORIZON = vec3(0.75, 0.8, 0.85);
+const vec3 SKY_ZENITH = vec3(0.3, 0.45, 0.75);
+
+// Per queue: x groups, 1, 1 as glDispatchComputeIndirect arguments, then the
+// length; the items follow, pathCount slots per queue
+layout(std430, binding = 6) buffer WavefrontQueueBuffer
+{
+    uint queueHeaders[4 * QUEUE_COUNT];
+    uint queueItems[];
+};
+
+// PATH_STRIDE vec4 per path, indexed like the pixels:
+//   origin.xyz, random state bits
+//   direction.xyz
+//   throughput.rgb, hit distance
+//   geometric normal.xyz, surface
+//   radiance.rgb gathered so far, primary hit distance (NO_HIT on a miss)
+//   shadow ray origin.xyz
+//   shadow ray contribution.rgb
+layout(std430, binding = 7) buffer WavefrontPathBuffer
+{
+    vec4 paths[];
+};
+
+const int PATH_STRIDE = 7;
+
+uint pathCount()
+{
+    return uint(windowWidth * windowHeight);
+}
+
+void pushQueue(int queue, uint path)
+{
+    uint slot = atomicAdd(queueHeaders[4 * queue + 3], 1u);
+    if (slot % WAVEFRONT_GROUP_SIZE == 0u)
+        atomicAdd(queueHeaders[4 * queue], 1u);
+    queueItems[uint(queue) * pathCount() + slot] = path;
+}
+
+// The path this invocation handles in a queue dispatch; false past its end
+bool queuedPath(int queue, out uint path)
+{
+    uint index = gl_GlobalInvocationID.x;
+    path = 0u;
+    if (index >= queueHeaders[4 * queue + 3])
+        return false;
+    path = queueItems[uint(queue) * pathCount() + index];
+    return true;
+}
+
+// PCG hash (Jarzynski and Olano); the CPU mirror uses the same integers
+uint pcgHash(uint v)
+{
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Uniform in [0, 1)
+float random(inout uint state)
+{
+    state = pcgHash(state);
+    return float(state >> 8u) * (1.0 / 16777216.0);
+}
+
+int surfaceOf(uint prim)
+{
+    if (prim < uint(sphereCount))
+        return SURFACE_SPHERE;
+    return prim < uint(sphereCount + triangleCount) ? SURFACE_TRIANGLE : SURFACE_INSTANCE;
+}
+
+int surfaceMaterial(int surface)
+{
+    return surface == SURFACE_INSTANCE ? MATERIAL_MIRROR : MATERIAL_DIFFUSE;
+}
+
+vec3 surfaceAlbedo(int surface)
+{
+    if (surface == SURFACE_SPHERE)
+        return vec3(0.9, 0.2, 0.2);
+    return surface == SURFACE_TRIANGLE ? vec3(0.75, 0.75, 0.75) : vec3(0.9, 0.9, 0.85);
+}
+
+vec3 skyRadiance(vec3 direction)
+{
+    return mix(SKY_HORIZON, SKY_ZENITH, max(direction.y, 0.0));
+}
+
+// Unit geometric normal at position of what traceSceneHit reported, in world
+// space and as wound, not turned towards the ray
+vec3 hitNormal(vec3 position, uint prim, int triangle)
+{
+    if (SCENE_SPHERES && prim < uint(sphereCount))
+        return normalize(position - spheres[prim].xyz);
+
+    int base = 3 * triangle;
+    vec3 edge1 = triangles[base + 1].xyz;
+    vec3 edge2 = triangles[base + 2].xyz;
+    if (WATERTIGHT_TRIANGLES)
+    {
+        edge1 -= triangles[base].xyz;
+        edge2 -= triangles[base].xyz;
+    }
+    vec3 normal = cross(edge1, edge2);
+    uint instanceBase = uint(sphereCount + triangleCount);
+    if (SCENE_INSTANCES && prim >= instanceBase)
+    {
+        // Normals go through the inverse transpose: the transpose of world-to-object
+        int instance = 4 * int(prim - instanceBase);
+        normal = normal.x * instances[instance].xyz + normal.y * instances[instance + 1].xyz + normal.z * instances[instance + 2].xyz;
+    }
+    return normalize(normal);
+}
+
+// Cosine-weighted direction about the unit normal n, in the branchless
+// orthonormal basis of Duff et al.
+vec3 cosineSampleHemisphere(vec3 n, float u1, float u2)
+{
+    float s = n.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (s + n.z);
+    float b = n.x * n.y * a;
+    vec3 tangent = vec3(1.0 + s * n.x * n.x * a, s * b, -s * n.x);
+    vec3 bitangent = vec3(b, s + n.y * n.y * a, -n.y);
+    float r = sqrt(u1);
+    float phi = 2.0 * PI * u2;
+    return normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + n * sqrt(max(0.0, 1.0 - u1)));
+}
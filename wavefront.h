@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "vec3.h"
+#include "thread_pool.h"
+#include "scene.h"
+#include "cpu_tracer.h"
+#include "adaptive.h"
+
+// Wavefront path tracing: instead of one shader carrying every path through
+// all its bounces, each stage runs as its own pass over a queue of paths:
+// generate starts a path per pixel, extend finds the nearest hits and bins
+// them by material, shade runs once per material and queues shadow rays and
+// continuations, and connect traces the shadow rays. The GPU version is
+// wavefront.glsl and its kernels; the queues and constants here match it.
+
+enum WavefrontQueue
+{
+    WavefrontQueueRays,         // two, swapped every bounce
+    WavefrontQueueMaterials = 2,// one per material, in WavefrontMaterial order
+    WavefrontQueueShadow = 4,
+    WavefrontQueueCount
+};
+
+enum WavefrontMaterial
+{
+    WavefrontMaterialDiffuse,
+    WavefrontMaterialMirror,
+    WavefrontMaterialCount
+};
+
+const int wavefrontMaxBounces = 4;
+const int wavefrontGroupSize = 64;  // local_size_x of the queue kernels
+
+struct WavefrontStats
+{
+    double milliseconds;
+    long long extensionRays;
+    long long shadowRays;
+    long long shaded[WavefrontMaterialCount];
+};
+
+// CPU mirror of the GPU wavefront path tracer: the same stages in the same
+// order over the same queues, each one parallel_for over its queue in chunks
+// of wavefrontGroupSize with atomic appends, and the same random numbers.
+// Extension rays go through the binary BVH since the wide and batch paths
+// don't report what they hit; shadow rays use cpuBvh's configured path.
+// Rays go through pixel centers, without the GPU's per-sample jitter.
+// With params.adaptiveError set, TileScheduler picks the tiles that take
+// each sample, as adaptive_schedule.comp does on the GPU.
+class CpuWavefront
+{
+public:
+    // Traces one sample per scheduled pixel and folds it into the running average.
+    WavefrontStats render_sample(const CpuFrameParams& params, const Scene& scene, const CpuSceneBvh& cpuBvh, ThreadPool& pool);
+    // Starts the average over, e.g. after the scene changed.
+    void reset() { sampleCount = 0; }
+    int sample_count() const { return sampleCount; }
+    AdaptiveStats adaptive_stats() const { return scheduler.stats(); }
+
+    // The average as bottom-to-top RGB bytes, clamped like the GPU's 8-bit target.
+    void resolve(std::vector<unsigned char>& rgb) const;
+
+private:
+    struct Path
+    {
+        Vec3 origin;
+        uint32_t rng;
+        Vec3 direction;
+        Vec3 throughput;
+        float t;
+        Vec3 normal;
+        int surface;
+        Vec3 radiance;
+        Vec3 shadowOrigin;
+        Vec3 shadowContribution;
+    };
+
+    struct Queue
+    {
+        std::vector<uint32_t> items;
+        std::atomic<uint32_t> length{0};
+
+        void push(uint32_t path) { items[length.fetch_add(1, std::memory_order_relaxed)] = path; }
+    };
+
+    std::vector<Path> paths;
+    Queue queues[WavefrontQueueCount];
+    std::vector<Vec3> average;
+    std::vector<float> moments;     // per pixel, as in adaptive.h
+    TileScheduler scheduler;
+    int width = 0;
+    int height = 0;
+    int sampleCount = 0;
+};
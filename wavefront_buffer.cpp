@@ -0,0 +1,44 @@
+#include "wavefront_buffer.h"
+
+const size_t headerSize = 4 * sizeof(GLuint);
+const size_t pathStride = 7 * 4 * sizeof(float);
+
+void WavefrontBuffer::init(int pathCount)
+{
+    glCreateBuffers(1, &queueBuffer);
+    glNamedBufferStorage(queueBuffer, WavefrontQueueCount * (headerSize + pathCount * sizeof(GLuint)), nullptr,
+                         GL_DYNAMIC_STORAGE_BIT);
+    glCreateBuffers(1, &pathBuffer);
+    glNamedBufferStorage(pathBuffer, pathCount * pathStride, nullptr, 0);
+    clear_queues(0, WavefrontQueueCount);
+}
+
+void WavefrontBuffer::release()
+{
+    if (queueBuffer)
+    {
+        glDeleteBuffers(1, &queueBuffer);
+        glDeleteBuffers(1, &pathBuffer);
+        queueBuffer = pathBuffer = 0;
+    }
+}
+
+void WavefrontBuffer::bind() const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, queueBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, pathBuffer);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queueBuffer);
+}
+
+void WavefrontBuffer::clear_queues(int first, int count)
+{
+    // No groups, and the 1, 1 the indirect dispatch needs for y and z
+    const GLuint empty[4] = { 0, 1, 1, 0 };
+    glClearNamedBufferSubData(queueBuffer, GL_RGBA32UI, first * headerSize, count * headerSize, GL_RGBA_INTEGER,
+                              GL_UNSIGNED_INT, empty);
+}
+
+void WavefrontBuffer::dispatch(int queue) const
+{
+    glDispatchComputeIndirect(static_cast<GLintptr>(queue * headerSize));
+}
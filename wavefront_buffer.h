@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "wavefront.h"
+
+// GPU storage of the wavefront path tracer, laid out std430 for
+// wavefront.glsl and only ever touched by the kernels, so unlike
+// SceneBuffer it is never mapped:
+//   binding 6: uint queueHeaders[4 * WavefrontQueueCount], then
+//              uint queueItems[WavefrontQueueCount * pathCount]
+//   binding 7: vec4 paths[7 * pathCount]
+// A queue's header is its indirect dispatch size (x groups, 1, 1) followed
+// by its length, so a stage is dispatched over exactly the paths queued for
+// it without reading anything back.
+// init and release need a current GL context.
+class WavefrontBuffer
+{
+public:
+    void init(int pathCount);
+    void release();
+
+    // Binds both blocks and makes the headers the indirect dispatch buffer.
+    void bind() const;
+    // Empties queues [first, first + count).
+    void clear_queues(int first, int count);
+    // One group of wavefrontGroupSize invocations per wavefrontGroupSize queued paths.
+    void dispatch(int queue) const;
+
+private:
+    GLuint queueBuffer = 0;
+    GLuint pathBuffer = 0;
+};